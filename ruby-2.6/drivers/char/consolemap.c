@@ -174,6 +174,7 @@ struct uni_pagedir {
 	unsigned long	refcount;
 	unsigned long	sum;
 	unsigned char	*inverse_translations[4];
+	u16		*inverse_trans_unicode;
 	int		readonly;
 };
 
@@ -204,6 +205,40 @@ static void set_inverse_transl(struct vc_data *vc, struct uni_pagedir *p, int i)
 	}
 }
 
+/*
+ * Glyph -> unicode, straight from the unimap rather than through one of
+ * the 8-bit translations, so a selection can keep what was on screen.
+ */
+static void set_inverse_trans_unicode(struct vc_data *vc, struct uni_pagedir *p)
+{
+	int i, j, k, glyph;
+	u16 **p1, *p2, *q;
+
+	if (!p) return;
+	q = p->inverse_trans_unicode;
+	if (!q) {
+		q = p->inverse_trans_unicode =
+			kmalloc(MAX_GLYPH * sizeof(u16), GFP_KERNEL);
+		if (!q) return;
+	}
+	memset(q, 0, MAX_GLYPH * sizeof(u16));
+
+	for (i = 0; i < 32; i++) {
+		if (!(p1 = p->uni_pgdir[i]))
+			continue;
+		for (j = 0; j < 32; j++) {
+			if (!(p2 = p1[j]))
+				continue;
+			for (k = 0; k < 64; k++) {
+				glyph = p2[k];
+				/* lowest printable code point wins, as above */
+				if (glyph >= 0 && glyph < MAX_GLYPH && q[glyph] < 32)
+					q[glyph] = (i << 11) + (j << 6) + k;
+			}
+		}
+	}
+}
+
 void set_translate(struct vc_data *vc, int m)
 {
 	inv_translate[vc->vc_num] = m;
@@ -229,6 +264,23 @@ unsigned char inverse_translate(struct vc_data *vc, int glyph)
 		return p->inverse_translations[inv_translate[vc->vc_num]][glyph];
 }
 
+u16 inverse_translate_unicode(struct vc_data *vc, int glyph)
+{
+	struct uni_pagedir *p;
+	unsigned char c;
+	u16 u;
+
+	if (glyph < 0 || glyph >= MAX_GLYPH)
+		return 0;
+	p = (struct uni_pagedir *)*vc->vc_uni_pagedir_loc;
+	if (p && p->inverse_trans_unicode && p->inverse_trans_unicode[glyph])
+		return p->inverse_trans_unicode[glyph];
+	/* Nothing in the unimap: fall back on the 8-bit map in use */
+	c = inverse_translate(vc, glyph);
+	u = vc->vc_translate[c];
+	return (u & 0xff00) == 0xf000 ? c : u;	/* direct-to-font */
+}
+
 static void update_user_maps(struct vc_data *vc)
 {
 	struct uni_pagedir *p, *q = NULL;
@@ -354,6 +406,10 @@ static void con_release_unimap(struct uni_pagedir *p)
 			kfree(p->inverse_translations[i]);
 			p->inverse_translations[i] = NULL;
 		}
+	if (p->inverse_trans_unicode) {
+		kfree(p->inverse_trans_unicode);
+		p->inverse_trans_unicode = NULL;
+	}
 }
 
 void con_free_unimap(struct vc_data *vc)
@@ -512,6 +568,7 @@ int con_set_unimap(struct vc_data *vc, ushort ct, struct unipair __user *list)
 
 	for (i = 0; i <= 3; i++)
 		set_inverse_transl(vc, p, i); /* Update all inverse translations */
+	set_inverse_trans_unicode(vc, p);
 	return err;
 }
 
@@ -526,13 +583,15 @@ int con_set_default_unimap(struct vc_data *vc)
 	u16 *q;
 	struct uni_pagedir *p;
 	
+	/* All VCs on the default map share dflt; con_set_unimap copies it
+	   before changing it for one of them */
 	if (dflt) {
 		p = (struct uni_pagedir *)*vc->vc_uni_pagedir_loc;
 		if (p == dflt)
 			return 0;
 		dflt->refcount++;
 		*vc->vc_uni_pagedir_loc = (unsigned long)dflt;
-		if (p && --p->refcount) {
+		if (p && !--p->refcount) {
 			con_release_unimap(p);
 			kfree(p);
 		}
@@ -560,6 +619,7 @@ int con_set_default_unimap(struct vc_data *vc)
 
 	for (i = 0; i <= 3; i++)
 		set_inverse_transl(vc, p, i);	/* Update all inverse translations */
+	set_inverse_trans_unicode(vc, p);
 	dflt = p;
 	return err;
 }
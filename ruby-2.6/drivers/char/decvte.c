@@ -1153,6 +1153,7 @@ void terminal_emulation(struct tty_struct *tty, int c)
 		return;
 	case 0x1b:		/* ESC - Escape */
 		vc->vc_state = ESesc;
+		vc->vc_stats.escapes++;
 		return;
 	case 0x1c:		/* IS4 - */
 	case 0x1d:		/* IS3 - */
@@ -1229,6 +1230,7 @@ void terminal_emulation(struct tty_struct *tty, int c)
 			return;
 		case 0x9b:	/* CSI - Control sequence introducer */
 			vc->vc_state = EScsi;
+			vc->vc_stats.escapes++;
 			return;
 		case 0x9c:	/* ST  - String Terminator */
 		case 0x9d:	/* OSC - Operating system command */
@@ -1534,7 +1536,7 @@ void terminal_emulation(struct tty_struct *tty, int c)
 			break;
 		case 'm':
 			if (vc->vc_priv4) {
-				clear_selection();
+				clear_selection_on(vc->display_fg);
 				if (vc->vc_par[0])
 					vc->vc_complement_mask =
 					    vc->vc_par[0] << 8 | vc->vc_par[1];
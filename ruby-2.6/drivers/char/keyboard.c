@@ -33,15 +33,17 @@
 #include <linux/string.h>
 #include <linux/init.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/rcupdate.h>
 
 #include <linux/kbd_diacr.h>
 #include <linux/vt_kern.h>
 #include <linux/sysrq.h>
 #include <linux/input.h>
+#include <linux/input_core.h>
 
 static void kbd_disconnect(struct input_handle *handle);
 extern void ctrl_alt_del(void);
-void compute_shiftstate(void);
 
 /*
  * Handler Tables.
@@ -83,23 +85,11 @@ const int max_vals[] = {
 const int NR_TYPES = ARRAY_SIZE(max_vals);
 int spawnpid, spawnsig;
 
-/*
- * Variables exported for vt.c
- */
-
-int shift_state = 0;
-
 /*
  * Internal Data.
  */
 
 static struct input_handler kbd_handler;
-static unsigned long key_down[NBITS(KEY_MAX)];		/* keyboard key bitmap */
-static unsigned char shift_down[NR_SHIFT];		/* shift state counters.. */
-static int dead_key_next;
-static int npadch = -1;					/* -1 or number assembled on pad */
-static unsigned char diacr;
-static char rep;					/* flag telling character repeat */
 
 static struct ledptr {
 	unsigned int *addr;
@@ -118,9 +108,7 @@ unsigned char kbd_sysrq_xlate[KEY_MAX + 1] =
         "\206\207\210\211\212\000\000789-456+1"         /* 0x40 - 0x4f */
         "230\177\000\000\213\214\000\000\000\000\000\000\000\000\000\000" /* 0x50 - 0x5f */
         "\r\000/";                                      /* 0x60 - 0x6f */
-static int sysrq_down;
 #endif
-static int sysrq_alt;
 
 /*
  * Translation of scancodes to keycodes. We set them on only the first attached
@@ -226,16 +214,45 @@ int kbd_rate(struct input_handle *handle, struct kbd_repeat *rep)
 /*
  * Helper Functions.
  */
+
+/*
+ * What the keyboard produces while handling an input frame is gathered
+ * in the seat's stage and handed to the tty in one piece when the frame
+ * is done, so a burst of keys costs one flip buffer insert and one work
+ * schedule instead of one per byte.
+ */
+static void kbd_flush_queue(struct kbd_seat *kbd)
+{
+	struct tty_struct *tty = kbd->stage_tty;
+
+	if (!kbd->stage_count)
+		return;
+	tty_insert_flip_string(tty, kbd->stage, kbd->stage_count);
+	kbd->stage_count = 0;
+	schedule_work(&tty->flip.work);
+}
+
 static void put_queue(struct vc_data *vc, int ch)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	struct tty_struct *tty = vc->vc_tty;
 
-	if (tty) {
-		tty_insert_flip_char(tty, ch, 0);
-		schedule_work(&tty->flip.work);
+	if (!tty)
+		return;
+	if (kbd->stage_tty != tty || kbd->stage_count == KBD_STAGE_SIZE) {
+		kbd_flush_queue(kbd);
+		kbd->stage_tty = tty;
 	}
+	kbd->stage[kbd->stage_count++] = ch;
+}
+
+static void kbd_puts(struct vc_data *vc, char *cp)
+{
+	while (*cp)
+		put_queue(vc, *cp++);
 }
 
+/* For replies from the terminal emulation; these go out at once */
 void puts_queue(struct vc_data *vc, char *cp)
 {
 	struct tty_struct *tty = vc->vc_tty;
@@ -243,10 +260,7 @@ void puts_queue(struct vc_data *vc, char *cp)
 	if (!tty)
 		return;
 
-	while (*cp) {
-		tty_insert_flip_char(tty, *cp, 0);
-		cp++;
-	}
+	tty_insert_flip_string(tty, cp, strlen(cp));
 	schedule_work(&tty->flip.work);
 }
 
@@ -256,7 +270,7 @@ static void applkey(struct vc_data *vc, int key, char mode)
 
 	buf[1] = (mode ? 'O' : '[');
 	buf[2] = key;
-	puts_queue(vc, buf);
+	kbd_puts(vc, buf);
 }
 
 /*
@@ -288,23 +302,30 @@ static void to_utf8(struct vc_data *vc, ushort c)
  * shift_down[] and shift_state from key_down[] maybe called when keymap is
  * undefined, so that shiftkey release is seen
  */
-void compute_shiftstate(void)
+void kbd_seat_init(struct kbd_seat *kbd)
+{
+	memset(kbd, 0, sizeof(struct kbd_seat));
+	kbd->npadch = -1;
+}
+
+void compute_shiftstate(struct vt_struct *vt)
 {
+	struct kbd_seat *kbd = &vt->kbd;
 	unsigned int i, j, k, sym, val;
 
-	shift_state = 0;
-	memset(shift_down, 0, sizeof(shift_down));
+	kbd->shift_state = 0;
+	memset(kbd->shift_down, 0, sizeof(kbd->shift_down));
 	
-	for (i = 0; i < ARRAY_SIZE(key_down); i++) {
+	for (i = 0; i < ARRAY_SIZE(kbd->key_down); i++) {
 
-		if (!key_down[i])
+		if (!kbd->key_down[i])
 			continue;
 
 		k = i * BITS_PER_LONG;
 
 		for (j = 0; j < BITS_PER_LONG; j++, k++) {
 
-			if (!test_bit(k, key_down))
+			if (!test_bit(k, kbd->key_down))
 				continue;
 
 			sym = U(key_maps[0][k]);
@@ -315,8 +336,8 @@ void compute_shiftstate(void)
 			if (val == KVAL(K_CAPSSHIFT))
 				val = KVAL(K_SHIFT);
 
-			shift_down[val]++;
-			shift_state |= (1 << val);
+			kbd->shift_down[val]++;
+			kbd->shift_state |= (1 << val);
 		}
 	}
 }
@@ -330,10 +351,11 @@ void compute_shiftstate(void)
  */
 static unsigned char handle_diacr(struct vc_data *vc, unsigned char ch)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	unsigned int i;
-	int d = diacr;
+	int d = kbd->diacr;
 
-	diacr = 0;
+	kbd->diacr = 0;
 
 	for (i = 0; i < accent_table_size; i++) {
 		if (accent_table[i].diacr == d && accent_table[i].base == ch)
@@ -352,9 +374,10 @@ static unsigned char handle_diacr(struct vc_data *vc, unsigned char ch)
  */
 static void fn_enter(struct vc_data *vc)
 {
-	if (diacr) {
-		put_queue(vc, diacr);
-		diacr = 0;
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
+	if (kbd->diacr) {
+		put_queue(vc, kbd->diacr);
+		kbd->diacr = 0;
 	}
 	put_queue(vc, 13);
 	if (get_kbd_mode(&vc->kbd_table, VC_CRLF))
@@ -363,14 +386,16 @@ static void fn_enter(struct vc_data *vc)
 
 static void fn_caps_toggle(struct vc_data *vc)
 {
-	if (rep)
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
+	if (kbd->rep)
 		return;
 	chg_kbd_led(&vc->kbd_table, VC_CAPSLOCK);
 }
 
 static void fn_caps_on(struct vc_data *vc)
 {
-	if (rep)
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
+	if (kbd->rep)
 		return;
 	set_kbd_led(&vc->kbd_table, VC_CAPSLOCK);
 }
@@ -386,9 +411,10 @@ static void fn_show_ptregs(struct vc_data *vc)
 
 static void fn_hold(struct vc_data *vc)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	struct tty_struct *tty = vc->vc_tty;
 
-	if (rep || !tty)
+	if (kbd->rep || !tty)
 		return;
 
 	/*
@@ -418,7 +444,8 @@ static void fn_num(struct vc_data *vc)
  */
 static void fn_bare_num(struct vc_data *vc)
 {
-	if (!rep)
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
+	if (!kbd->rep)
 		chg_kbd_led(&vc->kbd_table, VC_NUMLOCK);
 }
 
@@ -466,7 +493,8 @@ static void fn_send_intr(struct vc_data *vc)
 
 	if (!tty)
 		return;
-	tty_insert_flip_char(tty, 0, TTY_BREAK);
+	kbd_flush_queue(&vc->display_fg->kbd);
+	tty_insert_flip_flag(tty, 0, TTY_BREAK);
 	schedule_work(&tty->flip.work);
 }
 
@@ -497,7 +525,8 @@ static void fn_boot_it(struct vc_data *vc)
 
 static void fn_compose(struct vc_data *vc)
 {
-	dead_key_next = 1;
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
+	kbd->dead_key_next = 1;
 }
 
 static void fn_spawn_con(struct vc_data *vc)
@@ -522,7 +551,7 @@ static void fn_SAK(struct vc_data *vc)
 
 static void fn_null(struct vc_data *vc)
 {
-	compute_shiftstate();
+	compute_shiftstate(vc->display_fg);
 }
 
 /*
@@ -552,15 +581,16 @@ static void k_lowercase(struct vc_data *vc, unsigned char value, char up_flag)
 
 static void k_self(struct vc_data *vc, unsigned char value, char up_flag)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	if (up_flag)
 		return;		/* no action, if this is a key release */
 
-	if (diacr)
+	if (kbd->diacr)
 		value = handle_diacr(vc, value);
 
-	if (dead_key_next) {
-		dead_key_next = 0;
-		diacr = value;
+	if (kbd->dead_key_next) {
+		kbd->dead_key_next = 0;
+		kbd->diacr = value;
 		return;
 	}
 	put_queue(vc, value);
@@ -573,9 +603,10 @@ static void k_self(struct vc_data *vc, unsigned char value, char up_flag)
  */
 static void k_dead2(struct vc_data *vc, unsigned char value, char up_flag)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	if (up_flag)
 		return;
-	diacr = (diacr ? handle_diacr(vc, value) : value);
+	kbd->diacr = (kbd->diacr ? handle_diacr(vc, value) : value);
 }
 
 /*
@@ -606,7 +637,7 @@ static void k_fn(struct vc_data *vc, unsigned char value, char up_flag)
 	v = value;
 	if (v < ARRAY_SIZE(func_table)) {
 		if (func_table[value])
-			puts_queue(vc, func_table[value]);
+			kbd_puts(vc, func_table[value]);
 	} else
 		printk(KERN_ERR "k_fn called with value=%d\n", value);
 }
@@ -622,6 +653,7 @@ static void k_cur(struct vc_data *vc, unsigned char value, char up_flag)
 
 static void k_pad(struct vc_data *vc, unsigned char value, char up_flag)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	static const char *pad_chars = "0123456789+-*/\015,.?()#";
 	static const char *app_map = "pqrstuvwxylSRQMnnmPQS";
 
@@ -629,7 +661,7 @@ static void k_pad(struct vc_data *vc, unsigned char value, char up_flag)
 		return;		/* no action, if this is a key release */
 
 	/* kludge... shift forces cursor/number keys */
-	if (get_kbd_mode(&vc->kbd_table, VC_APPLIC) && !shift_down[KG_SHIFT]) {
+	if (get_kbd_mode(&vc->kbd_table, VC_APPLIC) && !kbd->shift_down[KG_SHIFT]) {
 		applkey(vc, app_map[value], 1);
 		return;
 	}
@@ -679,9 +711,10 @@ static void k_pad(struct vc_data *vc, unsigned char value, char up_flag)
 
 static void k_shift(struct vc_data *vc, unsigned char value, char up_flag)
 {
-	int old_state = shift_state;
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
+	int old_state = kbd->shift_state;
 
-	if (rep)
+	if (kbd->rep)
 		return;
 	/*
 	 * Mimic typewriter:
@@ -698,23 +731,23 @@ static void k_shift(struct vc_data *vc, unsigned char value, char up_flag)
 		 * handle the case that two shift or control
 		 * keys are depressed simultaneously
 		 */
-		if (shift_down[value])
-			shift_down[value]--;
+		if (kbd->shift_down[value])
+			kbd->shift_down[value]--;
 	} else
-		shift_down[value]++;
+		kbd->shift_down[value]++;
 
-	if (shift_down[value])
-		shift_state |= (1 << value);
+	if (kbd->shift_down[value])
+		kbd->shift_state |= (1 << value);
 	else
-		shift_state &= ~(1 << value);
+		kbd->shift_state &= ~(1 << value);
 
 	/* kludge */
-	if (up_flag && shift_state != old_state && npadch != -1) {
+	if (up_flag && kbd->shift_state != old_state && kbd->npadch != -1) {
 		if (vc->kbd_table.kbdmode == VC_UNICODE)
-			to_utf8(vc, npadch & 0xffff);
+			to_utf8(vc, kbd->npadch & 0xffff);
 		else
-			put_queue(vc, npadch & 0xff);
-		npadch = -1;
+			put_queue(vc, kbd->npadch & 0xff);
+		kbd->npadch = -1;
 	}
 }
 
@@ -732,6 +765,7 @@ static void k_meta(struct vc_data *vc, unsigned char value, char up_flag)
 
 static void k_ascii(struct vc_data *vc, unsigned char value, char up_flag)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	int base;
 
 	if (up_flag)
@@ -746,23 +780,25 @@ static void k_ascii(struct vc_data *vc, unsigned char value, char up_flag)
 		base = 16;
 	}
 
-	if (npadch == -1)
-		npadch = value;
+	if (kbd->npadch == -1)
+		kbd->npadch = value;
 	else
-		npadch = npadch * base + value;
+		kbd->npadch = kbd->npadch * base + value;
 }
 
 static void k_lock(struct vc_data *vc, unsigned char value, char up_flag)
 {
-	if (up_flag || rep)
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
+	if (up_flag || kbd->rep)
 		return;
 	chg_kbd_lock(&vc->kbd_table, value);
 }
 
 static void k_slock(struct vc_data *vc, unsigned char value, char up_flag)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	k_shift(vc, value, up_flag);
-	if (up_flag || rep)
+	if (up_flag || kbd->rep)
 		return;
 	chg_kbd_slock(&vc->kbd_table, value);
 	/* try to make Alt, oops, AltGr and such work */
@@ -925,6 +961,7 @@ extern void sun_do_break(void);
 static int emulate_raw(struct vc_data *vc, unsigned int keycode, 
 		       unsigned char up_flag)
 {
+	struct kbd_seat *kbd = &vc->display_fg->kbd;
 	if (keycode > 255 || !x86_keycodes[keycode])
 		return -1; 
 
@@ -942,7 +979,7 @@ static int emulate_raw(struct vc_data *vc, unsigned int keycode,
 			return 0;
 	} 
 
-	if (keycode == KEY_SYSRQ && sysrq_alt) {
+	if (keycode == KEY_SYSRQ && kbd->sysrq_alt) {
 		put_queue(vc, 0x54 | up_flag);
 		return 0;
 	}
@@ -982,13 +1019,101 @@ static void kbd_rawcode(struct vc_data *vc, unsigned char data)
 		put_queue(vc, data);
 }
 
+/*
+ * Compiled keymaps. For every allocated keymap we keep two dense rows
+ * of final keysyms, one for capslock off and one for on, with KT_LETTER
+ * already resolved to KT_LATIN through the shifted map. kbd_keycode()
+ * then finds its keysym with one load instead of the map lookup, the
+ * letter test and the capslock re-lookup. KDSKBENT patches single
+ * entries in place; allocating or freeing a map recompiles it all.
+ */
+struct kbd_compiled {
+	unsigned char slot[MAX_NR_KEYMAPS];	/* 1 + row of each map, 0 if none */
+	unsigned short keys[0][2][NR_KEYS];
+};
+
+static struct kbd_compiled *kbd_compiled;
+
+static unsigned short kbd_resolve(int table, int index, int caps)
+{
+	unsigned short keysym = key_maps[table][index], *shifted;
+
+	if (KTYP(keysym) != 0xf0 + KT_LETTER)
+		return keysym;
+
+	if (caps && (shifted = key_maps[table ^ (1 << KG_SHIFT)]))
+		keysym = shifted[index];
+	return ((0xf0 + KT_LATIN) << 8) | KVAL(keysym);
+}
+
+static void kbd_compile_entry(struct kbd_compiled *cm, int table, int index)
+{
+	int row = cm->slot[table] - 1;
+
+	cm->keys[row][0][index] = kbd_resolve(table, index, 0);
+	cm->keys[row][1][index] = kbd_resolve(table, index, 1);
+}
+
+static void kbd_compile_keymaps(void)
+{
+	struct kbd_compiled *cm, *old;
+	int i, k, n = 0;
+
+	for (i = 0; i < MAX_NR_KEYMAPS; i++)
+		if (key_maps[i])
+			n++;
+
+	cm = vmalloc(sizeof(struct kbd_compiled) + n * sizeof(cm->keys[0]));
+	if (cm) {
+		memset(cm->slot, 0, sizeof(cm->slot));
+		for (i = 0, n = 0; i < MAX_NR_KEYMAPS; i++)
+			if (key_maps[i])
+				cm->slot[i] = ++n;
+		for (i = 0; i < MAX_NR_KEYMAPS; i++)
+			if (cm->slot[i])
+				for (k = 0; k < NR_KEYS; k++)
+					kbd_compile_entry(cm, i, k);
+	}
+	/* Without a compiled table kbd_keycode() walks key_maps itself */
+
+	old = kbd_compiled;
+	rcu_assign_pointer(kbd_compiled, cm);
+	if (old) {
+		synchronize_rcu();
+		vfree(old);
+	}
+}
+
+/*
+ * Called from the KDSKBENT ioctl after key_maps[table][index] changed,
+ * or with index < 0 after the map itself was allocated or freed.
+ */
+void kbd_keymap_changed(int table, int index)
+{
+	struct kbd_compiled *cm = kbd_compiled;
+	int shifted = table ^ (1 << KG_SHIFT);
+
+	if (index < 0 || !cm) {
+		kbd_compile_keymaps();
+		return;
+	}
+
+	if (cm->slot[table])
+		kbd_compile_entry(cm, table, index);
+	/* The capslock row of the unshifted twin reads this map too */
+	if (cm->slot[shifted])
+		cm->keys[cm->slot[shifted] - 1][1][index] = kbd_resolve(shifted, index, 1);
+}
+
 static void kbd_keycode(struct vt_struct *vt, unsigned int keycode, int down, int hw_raw)
 {
+	struct kbd_seat *kbd = &vt->kbd;
 	struct vc_data *vc = vt->fg_console;
 	unsigned short keysym, *key_map;
 	unsigned char type, raw_mode;
+	struct kbd_compiled *cm;
 	struct tty_struct *tty;
-	int shift_final;
+	int shift_final, slot;
 
 	tty = vc->vc_tty;
 
@@ -998,13 +1123,13 @@ static void kbd_keycode(struct vt_struct *vt, unsigned int keycode, int down, in
 	}
 
 	if (keycode == KEY_LEFTALT || keycode == KEY_RIGHTALT)
-		sysrq_alt = down;
+		kbd->sysrq_alt = down;
 #if defined(CONFIG_SPARC32) || defined(CONFIG_SPARC64)
 	if (keycode == KEY_STOP)
 		sparc_l1_a_state = down;
 #endif
 
-	rep = (down == 2);
+	kbd->rep = (down == 2);
 
 #ifdef CONFIG_MAC_EMUMOUSEBTN
 	if (mac_hid_mouse_emulate_buttons(1, keycode, down))
@@ -1017,11 +1142,11 @@ static void kbd_keycode(struct vt_struct *vt, unsigned int keycode, int down, in
 				printk(KERN_WARNING "keyboard.c: can't emulate rawmode for keycode %d\n", keycode);
 
 #ifdef CONFIG_MAGIC_SYSRQ	       /* Handle the SysRq Hack */
-	if (keycode == KEY_SYSRQ && (sysrq_down || (down == 1 && sysrq_alt))) {
-		sysrq_down = down;
+	if (keycode == KEY_SYSRQ && (kbd->sysrq_down || (down == 1 && kbd->sysrq_alt))) {
+		kbd->sysrq_down = down;
 		return;
 	}
-	if (sysrq_down && down && !rep) {
+	if (kbd->sysrq_down && down && !kbd->rep) {
 		handle_sysrq(kbd_sysrq_xlate[keycode], vt->keyboard->dev->regs, tty);
 		return;
 	}
@@ -1054,11 +1179,11 @@ static void kbd_keycode(struct vt_struct *vt, unsigned int keycode, int down, in
 	}
 
 	if (down)
-		set_bit(keycode, key_down);
+		set_bit(keycode, kbd->key_down);
 	else
-		clear_bit(keycode, key_down);
+		clear_bit(keycode, kbd->key_down);
 
-	if (rep && (!get_kbd_mode(&vc->kbd_table, VC_REPEAT) || (tty && 
+	if (kbd->rep && (!get_kbd_mode(&vc->kbd_table, VC_REPEAT) || (tty && 
 		(!L_ECHO(tty) && tty->driver->chars_in_buffer(tty))))) {
 		/*
 		 * Don't repeat a key if the input buffers are not empty and the
@@ -1068,19 +1193,49 @@ static void kbd_keycode(struct vt_struct *vt, unsigned int keycode, int down, in
 		return;
 	}
 
-	shift_final = (shift_state | vc->kbd_table.slockstate) ^ vc->kbd_table.lockstate;
+	shift_final = (kbd->shift_state | vc->kbd_table.slockstate) ^ vc->kbd_table.lockstate;
+
+	rcu_read_lock();
+	cm = rcu_dereference(kbd_compiled);
+	if (cm) {
+		if (!(slot = cm->slot[shift_final])) {
+			rcu_read_unlock();
+			compute_shiftstate(vt);
+			vc->kbd_table.slockstate = 0;
+			return;
+		}
+		if (keycode >= NR_KEYS) {
+			rcu_read_unlock();
+			return;
+		}
+		keysym = cm->keys[slot - 1][!!get_kbd_led(&vc->kbd_table, VC_CAPSLOCK)][keycode];
+		rcu_read_unlock();
+		goto resolved;
+	}
+	rcu_read_unlock();
+
 	key_map = key_maps[shift_final];
 
 	if (!key_map) {
-		compute_shiftstate();
+		compute_shiftstate(vt);
 		vc->kbd_table.slockstate = 0;
 		return;
 	}
 
-	if (keycode > NR_KEYS)
+	if (keycode >= NR_KEYS)
 		return;
 
 	keysym = key_map[keycode];
+	if (KTYP(keysym) == 0xf0 + KT_LETTER) {
+		keysym = ((0xf0 + KT_LATIN) << 8) | KVAL(keysym);
+		if (get_kbd_led(&vc->kbd_table, VC_CAPSLOCK)) {
+			key_map = key_maps[shift_final ^ (1 << KG_SHIFT)];
+			if (key_map)
+				keysym = ((0xf0 + KT_LATIN) << 8) | KVAL(key_map[keycode]);
+		}
+	}
+
+resolved:
 	type = KTYP(keysym);
 
 	if (type < 0xf0) {
@@ -1093,21 +1248,33 @@ static void kbd_keycode(struct vt_struct *vt, unsigned int keycode, int down, in
 	if (raw_mode && type != KT_SPEC && type != KT_SHIFT)
 		return;
 
-	if (type == KT_LETTER) {
-		type = KT_LATIN;
-		if (get_kbd_led(&vc->kbd_table, VC_CAPSLOCK)) {
-			key_map = key_maps[shift_final ^ (1 << KG_SHIFT)];
-			if (key_map)
-				keysym = key_map[keycode];
-		}
-	}
-
 	(*k_handler[type])(vc, keysym & 0xff, !down);
 
 	if (type != KT_SLOCK)
 		vc->kbd_table.slockstate = 0;
 }
 
+static void __kbd_event(struct vt_struct *vt, struct input_handle *handle,
+			unsigned int event_type, unsigned int event_code, int value)
+{
+	if (event_type == EV_MSC && event_code == MSC_RAW && HW_RAW(handle->dev))
+		kbd_rawcode(vt->fg_console, value);
+	if (event_type == EV_KEY)
+		kbd_keycode(vt, event_code, value, HW_RAW(handle->dev));
+}
+
+/*
+ * End of a frame for this seat: push its output, and let the LED
+ * tasklet and the seat's VT work see everything the frame changed.
+ */
+static void kbd_frame_done(struct vt_struct *vt)
+{
+	kbd_flush_queue(&vt->kbd);
+	tasklet_schedule(&keyboard_tasklet);
+	vt->poke_blanked = 1;
+	schedule_vt_work(vt);
+}
+
 static void kbd_event(struct input_handle *handle, unsigned int event_type, 
 		      unsigned int event_code, int value)
 {
@@ -1115,13 +1282,21 @@ static void kbd_event(struct input_handle *handle, unsigned int event_type,
 
 	if (!vt)
 		return;
-	if (event_type == EV_MSC && event_code == MSC_RAW && HW_RAW(handle->dev))
-		kbd_rawcode(vt->fg_console, value);
-	if (event_type == EV_KEY)
-		kbd_keycode(vt, event_code, value, HW_RAW(handle->dev));
-	tasklet_schedule(&keyboard_tasklet);
-	do_poke_blanked_console = 1;
-	schedule_work(&vt->vt_work);
+	__kbd_event(vt, handle, event_type, event_code, value);
+	kbd_frame_done(vt);
+}
+
+static void kbd_events(struct input_handle *handle,
+		       const struct input_value *vals, unsigned int count)
+{
+	struct vt_struct *vt = handle->private;
+	unsigned int i;
+
+	if (!vt)
+		return;
+	for (i = 0; i < count; i++)
+		__kbd_event(vt, handle, vals[i].type, vals[i].code, vals[i].value);
+	kbd_frame_done(vt);
 }
 
 static char kbd_name[] = "kbd";
@@ -1227,6 +1402,8 @@ static struct input_handler kbd_handler = {
 
 int __init kbd_init(void)
 {
+	kbd_compile_keymaps();
+	input_set_events_handler(&kbd_handler, kbd_events);
 	input_register_handler(&kbd_handler);
 	tasklet_enable(&keyboard_tasklet);
 	tasklet_schedule(&keyboard_tasklet);
@@ -17,6 +17,7 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/types.h>
+#include <linux/wait.h>
 
 #include <asm/uaccess.h>
 
@@ -30,12 +31,29 @@
 #define isspace(c)	((c) == ' ')
 
 /* Variables for selection control. */
-/* Use a dynamic buffer, instead of static (Dec 1994) */
 struct vc_data *sel_cons;		/* must not be disallocated */
 static volatile int sel_start = -1; 	/* cleared by clear_selection */
 static int sel_end;
-static int sel_buffer_lth;
+
+/*
+ * The characters under the selection are cached in sel_cells, one per
+ * screen cell and indexed by cell, so dragging only reads the cells
+ * that join the selection. On a UTF-8 console the cells hold unicode
+ * taken from the unimap, otherwise the 8-bit inverse translation. The
+ * text to paste is laid out in sel_buffer from that cache when it is
+ * pasted, not on every mouse motion. Both buffers only ever grow.
+ */
+static u16 *sel_cells;
+static unsigned int sel_cells_size;
+static int sel_cells_start = -1;	/* Range sel_cells holds */
+static int sel_cells_end;
+static int sel_cells_row;		/* vc_size_row it was taken with */
+static int sel_cells_utf;		/* sel_cells hold unicode */
 static char *sel_buffer;
+static unsigned int sel_buffer_size;
+static int sel_buffer_lth;
+static int sel_buffer_stale;
+static DECLARE_MUTEX(paste_sem);	/* Serializes users of sel_buffer */
 
 /* clear_selection, highlight and highlight_pointer can be called
    from interrupt (via scrollback/front) */
@@ -81,6 +99,17 @@ void clear_selection(void)
 	}
 }
 
+/*
+ * The selection is guarded by the vt_sem of the display it is on. Code
+ * holding only its own display's lock clears it through here, which
+ * leaves a selection on any other display alone.
+ */
+void clear_selection_on(struct vt_struct *vt)
+{
+	if (sel_cons && sel_cons->display_fg == vt)
+		clear_selection();
+}
+
 /*
  * User settable table: what characters are to be considered alphabetic?
  * 256 bits
@@ -118,13 +147,92 @@ static inline unsigned short limit(const unsigned short v, const unsigned short
 	return (v > u) ? u : v;
 }
 
+static int sel_grow(void *buf, unsigned int *size, unsigned int need)
+{
+	char **p = buf, *q;
+
+	if (need <= *size)
+		return 0;
+	if (need < 2 * *size)
+		need = 2 * *size;
+	q = kmalloc(need, GFP_KERNEL);
+	if (!q)
+		return -ENOMEM;
+	if (*p) {
+		memcpy(q, *p, *size);
+		kfree(*p);
+	}
+	*p = q;
+	*size = need;
+	return 0;
+}
+
+/* Read the characters of cells s..e (screen offsets) into sel_cells */
+static void sel_fetch(int s, int e)
+{
+	for (; s <= e; s += 2)
+		sel_cells[s >> 1] = sel_cells_utf ?
+			inverse_translate_unicode(sel_cons,
+						  screen_glyph(sel_cons, s)) :
+			sel_pos(s);
+}
+
+static inline char *sel_put(char *p, u16 c)
+{
+	if (!sel_cells_utf || c < 0x80)
+		*p++ = c;
+	else if (c < 0x800) {
+		*p++ = 0xc0 | (c >> 6);
+		*p++ = 0x80 | (c & 0x3f);
+	} else {
+		*p++ = 0xe0 | (c >> 12);
+		*p++ = 0x80 | ((c >> 6) & 0x3f);
+		*p++ = 0x80 | (c & 0x3f);
+	}
+	return p;
+}
+
+/* Lay out the cached selection as text: trailing blanks become '\r' */
+static int sel_layout(void)
+{
+	char *bp, *obp;
+	int i, cells = (sel_cells_end - sel_cells_start) / 2 + 1;
+	u16 c;
+
+	if (!sel_buffer_stale)
+		return 0;
+	/* UTF-8 takes up to three bytes for each u16 */
+	if (sel_grow(&sel_buffer, &sel_buffer_size,
+		     (sel_cells_utf ? 3 : 1) * cells + 1))
+		return -ENOMEM;
+
+	bp = obp = sel_buffer;
+	for (i = sel_cells_start; i <= sel_cells_end; i += 2) {
+		c = sel_cells[i >> 1];
+		bp = sel_put(bp, c);
+		if (!isspace(c))
+			obp = bp;
+		if (! ((i + 2) % sel_cells_row)) {
+			/* strip trailing blanks from line and add newline,
+			   unless non-space at end of line. */
+			if (obp != bp) {
+				bp = obp;
+				*bp++ = '\r';
+			}
+			obp = bp;
+		}
+	}
+	sel_buffer_lth = bp - sel_buffer;
+	sel_buffer_stale = 0;
+	return 0;
+}
+
 /* set the current selection. Invoked by ioctl() or by kernel code. */
 int set_selection(const struct tiocl_selection __user *sel, struct tty_struct *tty)
 {
 	struct vc_data *vc = (struct vc_data *) tty->driver_data;
 	int sel_mode, new_sel_start, new_sel_end, spc;
-	char *bp, *obp;
-	int i, ps, pe;
+	int ps, pe, fresh;
 
 	poke_blanked_console(vc->display_fg);
 
@@ -165,7 +273,15 @@ int set_selection(const struct tiocl_selection __user *sel, struct tty_struct *t
 	}
 
 	if (sel_cons != vc->display_fg->fg_console) {
-		clear_selection();
+		struct vt_struct *old = sel_cons ? sel_cons->display_fg : NULL;
+
+		/* We hold the console sem, so may take a second vt_sem */
+		if (old && old != vc->display_fg) {
+			acquire_vt_sem(old);
+			clear_selection();
+			release_vt_sem(old);
+		} else
+			clear_selection();
 		sel_cons = vc->display_fg->fg_console;
 	}
 
@@ -223,6 +339,18 @@ int set_selection(const struct tiocl_selection __user *sel, struct tty_struct *t
 		if (isspace(sel_pos(pe)))
 			new_sel_end = pe;
 	}
+
+	if (sel_grow(&sel_cells, &sel_cells_size,
+		     ((new_sel_end >> 1) + 1) * sizeof(u16))) {
+		printk(KERN_WARNING "selection: kmalloc() failed\n");
+		clear_selection();
+		return -ENOMEM;
+	}
+	/* What we cached is only good while the selection stays up */
+	fresh = sel_start == -1 || sel_cells_row != vc->vc_size_row ||
+		sel_cells_utf != sel_cons->vc_utf;
+	sel_cells_utf = sel_cons->vc_utf;
+
 	if (sel_start == -1)	/* no current selection */
 		highlight(new_sel_start, new_sel_end);
 	else if (new_sel_start == sel_start)
@@ -249,49 +377,48 @@ int set_selection(const struct tiocl_selection __user *sel, struct tty_struct *t
 	sel_start = new_sel_start;
 	sel_end = new_sel_end;
 
-	/* Allocate a new buffer before freeing the old one ... */
-	bp = kmalloc((sel_end-sel_start)/2+1, GFP_KERNEL);
-	if (!bp) {
-		printk(KERN_WARNING "selection: kmalloc() failed\n");
-		clear_selection();
-		return -ENOMEM;
+	/* Only read the cells that weren't part of the old selection */
+	if (fresh)
+		sel_fetch(new_sel_start, new_sel_end);
+	else {
+		sel_fetch(new_sel_start, min(new_sel_end, sel_cells_start - 2));
+		sel_fetch(max(new_sel_start, sel_cells_end + 2), new_sel_end);
 	}
-	if (sel_buffer)
-		kfree(sel_buffer);
-	sel_buffer = bp;
-
-	obp = bp;
-	for (i = sel_start; i <= sel_end; i += 2) {
-		*bp = sel_pos(i);
-		if (!isspace(*bp++))
-			obp = bp;
-		if (! ((i + 2) % vc->vc_size_row)) {
-			/* strip trailing blanks from line and add newline,
-			   unless non-space at end of line. */
-			if (obp != bp) {
-				bp = obp;
-				*bp++ = '\r';
-			}
-			obp = bp;
-		}
-	}
-	sel_buffer_lth = bp - sel_buffer;
+	sel_cells_start = new_sel_start;
+	sel_cells_end = new_sel_end;
+	sel_cells_row = vc->vc_size_row;
+	sel_buffer_stale = 1;
 	return 0;
 }
 
 /* Insert the contents of the selection buffer into the
  * queue of the tty associated with the current console.
  * Invoked by ioctl().
+ *
+ * The buffer goes in as large a piece as the line discipline has room
+ * for. When it has none we sleep until vt_unthrottle() wakes us, or
+ * poll slowly if the ldisc is full without having throttled (canonical
+ * mode does that).
  */
 int paste_selection(struct tty_struct *tty)
 {
 	struct	vc_data *vc = (struct vc_data *) tty->driver_data;
 	struct	tty_ldisc *ld;
-	int	pasted = 0, count;
+	int	pasted = 0, count, ret = 0;
 	DECLARE_WAITQUEUE(wait, current);
 
+	if (down_interruptible(&paste_sem))
+		return -ERESTARTSYS;
+
 	acquire_console_sem();
+	acquire_vt_sem(vc->display_fg);
 	poke_blanked_console(vc->display_fg);
+	release_vt_sem(vc->display_fg);
+	if (sel_cells_start != -1 && sel_layout()) {
+		release_console_sem();
+		up(&paste_sem);
+		return -ENOMEM;
+	}
 	release_console_sem();
 
 	ld = tty_ldisc_ref_wait(tty);
@@ -299,17 +426,25 @@ int paste_selection(struct tty_struct *tty)
 	add_wait_queue(&vc->paste_wait, &wait);
 	while (sel_buffer && sel_buffer_lth > pasted) {
 		set_current_state(TASK_INTERRUPTIBLE);
-		if (test_bit(TTY_THROTTLED, &tty->flags)) {
-			schedule();
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		count = 0;
+		if (!test_bit(TTY_THROTTLED, &tty->flags))
+			count = min(sel_buffer_lth - pasted,
+				    ld->receive_room(tty));
+		if (count <= 0) {
+			schedule_timeout(HZ / 10);
 			continue;
 		}
-		count = sel_buffer_lth - pasted;
-		count = min(count, tty->ldisc.receive_room(tty));
-		tty->ldisc.receive_buf(tty, sel_buffer + pasted, NULL, count);
+		__set_current_state(TASK_RUNNING);
+		ld->receive_buf(tty, sel_buffer + pasted, NULL, count);
 		pasted += count;
 	}
 	remove_wait_queue(&vc->paste_wait, &wait);
 	set_current_state(TASK_RUNNING);
 	tty_ldisc_deref(ld);
-	return 0;
+	up(&paste_sem);
+	return ret;
 }
@@ -13,6 +13,7 @@
  */
 
 #include <linux/config.h>
+#include <linux/init.h>
 #include <linux/sched.h>
 #include <linux/interrupt.h>
 #include <linux/mm.h>
@@ -32,6 +33,7 @@
 #include <linux/buffer_head.h>		/* for fsync_bdev() */
 #include <linux/swap.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 #include <linux/vt_kern.h>
 #include <linux/workqueue.h>
 
@@ -156,10 +158,71 @@ static struct sysrq_key_op sysrq_showregs_op = {
 };
 
 
+/*
+ * The task and memory dumps can take seconds on a big machine, so the
+ * keys only queue them on sysrq's own workqueue: input and the other
+ * keys keep working meanwhile, and a wedged keventd doesn't swallow
+ * the dump. Pressing a key again while its dump is still queued is
+ * folded into it. Until the workqueue exists they run inline.
+ */
+static struct workqueue_struct *sysrq_wq;
+
+static void sysrq_defer(struct work_struct *work)
+{
+	if (!sysrq_wq)
+		work->func(work->data);
+	else if (!queue_work(sysrq_wq, work))
+		printk(KERN_INFO "Already queued\n");
+}
+
+extern int pid_max;
+
+#define SYSRQ_TASK_BATCH	32	/* Tasks per hold of tasklist_lock */
+
+static void sysrq_show_task(struct task_struct *p)
+{
+	static const char stat_nam[] = "RSDTtZX";
+	unsigned int state = p->state ? __ffs(p->state) + 1 : 0;
+
+	printk(KERN_INFO "%-13.13s %c %5d %5d\n", p->comm,
+	       state < sizeof(stat_nam) - 1 ? stat_nam[state] : '?',
+	       p->pid, p->parent->pid);
+	show_stack(p, NULL);
+}
+
+/*
+ * Like show_state(), but lets go of tasklist_lock and reschedules every
+ * SYSRQ_TASK_BATCH tasks, so the dump neither hogs the CPU nor holds up
+ * fork and exit for its whole length. Walking by pid keeps our place
+ * while tasks come and go in between.
+ */
+static void showstate_callback(void *ignored)
+{
+	struct task_struct *p;
+	int pid, n = 0;
+
+	printk(KERN_INFO "  task        S   pid  ppid\n");
+	read_lock(&tasklist_lock);
+	for (pid = 1; pid < pid_max; pid++) {
+		p = find_task_by_pid(pid);
+		if (!p)
+			continue;
+		sysrq_show_task(p);
+		if (++n % SYSRQ_TASK_BATCH)
+			continue;
+		read_unlock(&tasklist_lock);
+		cond_resched();
+		read_lock(&tasklist_lock);
+	}
+	read_unlock(&tasklist_lock);
+}
+
+static DECLARE_WORK(showstate_work, showstate_callback, NULL);
+
 static void sysrq_handle_showstate(int key, struct pt_regs *pt_regs,
 				   struct tty_struct *tty) 
 {
-	show_state();
+	sysrq_defer(&showstate_work);
 }
 static struct sysrq_key_op sysrq_showstate_op = {
 	.handler	= sysrq_handle_showstate,
@@ -169,10 +232,17 @@ static struct sysrq_key_op sysrq_showstate_op = {
 };
 
 
+static void showmem_callback(void *ignored)
+{
+	show_mem();
+}
+
+static DECLARE_WORK(showmem_work, showmem_callback, NULL);
+
 static void sysrq_handle_showmem(int key, struct pt_regs *pt_regs,
 				 struct tty_struct *tty) 
 {
-	show_mem();
+	sysrq_defer(&showmem_work);
 }
 static struct sysrq_key_op sysrq_showmem_op = {
 	.handler	= sysrq_handle_showmem,
@@ -257,7 +327,10 @@ static struct sysrq_key_op sysrq_unrt_op = {
 	.enable_mask	= SYSRQ_ENABLE_RTNICE,
 };
 
-/* Key Operations table and lock */
+/*
+ * Key Operations table. Readers, i.e. the sysrq keys themselves, only
+ * need rcu_read_lock(); the lock just serialises changes to it.
+ */
 static DEFINE_SPINLOCK(sysrq_key_table_lock);
 #define SYSRQ_KEY_TABLE_LENGTH 36
 static struct sysrq_key_op *sysrq_key_table[SYSRQ_KEY_TABLE_LENGTH] = {
@@ -332,7 +405,7 @@ struct sysrq_key_op *__sysrq_get_key_op (int key) {
         int i;
 	
 	i = sysrq_key_table_key2index(key);
-        op_p = (i == -1) ? NULL : sysrq_key_table[i];
+        op_p = (i == -1) ? NULL : rcu_dereference(sysrq_key_table[i]);
         return op_p;
 }
 
@@ -341,13 +414,12 @@ void __sysrq_put_key_op (int key, struct sysrq_key_op *op_p) {
 
 	i = sysrq_key_table_key2index(key);
         if (i != -1)
-                sysrq_key_table[i] = op_p;
+                rcu_assign_pointer(sysrq_key_table[i], op_p);
 }
 
 /*
- * This is the non-locking version of handle_sysrq
- * It must/can only be called by sysrq key handlers,
- * as they are inside of the lock
+ * This is the unchecked version of handle_sysrq. It only holds
+ * rcu_read_lock(), so sysrq key handlers may call it too.
  */
 
 void __handle_sysrq(int key, struct pt_regs *pt_regs, struct tty_struct *tty, int check_mask)
@@ -355,9 +427,8 @@ void __handle_sysrq(int key, struct pt_regs *pt_regs, struct tty_struct *tty, in
 	struct sysrq_key_op *op_p;
 	int orig_log_level;
 	int i, j;
-	unsigned long flags;
 
-	spin_lock_irqsave(&sysrq_key_table_lock, flags);
+	rcu_read_lock();
 	orig_log_level = console_loglevel;
 	console_loglevel = 7;
 	printk(KERN_INFO "SysRq : ");
@@ -377,16 +448,19 @@ void __handle_sysrq(int key, struct pt_regs *pt_regs, struct tty_struct *tty, in
 	} else {
 		printk("HELP : ");
 		/* Only print the help msg once per handler */
-		for (i=0; i<SYSRQ_KEY_TABLE_LENGTH; i++) 
-		if (sysrq_key_table[i]) {
-			for (j=0; sysrq_key_table[i] != sysrq_key_table[j]; j++);
+		for (i=0; i<SYSRQ_KEY_TABLE_LENGTH; i++) {
+			op_p = rcu_dereference(sysrq_key_table[i]);
+			if (!op_p)
+				continue;
+			/* The table may change under us; never look past i */
+			for (j=0; j < i && sysrq_key_table[j] != op_p; j++);
 			if (j == i)
-				printk ("%s ", sysrq_key_table[i]->help_msg);
+				printk ("%s ", op_p->help_msg);
 		}
 		printk ("\n");
 		console_loglevel = orig_log_level;
 	}
-	spin_unlock_irqrestore(&sysrq_key_table_lock, flags);
+	rcu_read_unlock();
 }
 
 /*
@@ -424,11 +498,28 @@ int register_sysrq_key(int key, struct sysrq_key_op *op_p)
 	return __sysrq_swap_key_ops(key, op_p, NULL);
 }
 
+/*
+ * May sleep: once this returns, no CPU is still running @op_p, so a
+ * module can go away.
+ */
 int unregister_sysrq_key(int key, struct sysrq_key_op *op_p)
 {
-	return __sysrq_swap_key_ops(key, NULL, op_p);
+	int retval;
+
+	retval = __sysrq_swap_key_ops(key, NULL, op_p);
+	if (!retval)
+		synchronize_rcu();
+	return retval;
+}
+
+static int __init sysrq_init(void)
+{
+	sysrq_wq = create_singlethread_workqueue("sysrq");
+	return 0;
 }
 
+__initcall(sysrq_init);
+
 EXPORT_SYMBOL(handle_sysrq);
 EXPORT_SYMBOL(register_sysrq_key);
 EXPORT_SYMBOL(unregister_sysrq_key);
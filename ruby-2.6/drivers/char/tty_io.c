@@ -163,8 +163,11 @@ static struct tty_struct *alloc_tty_struct(void)
 	return tty;
 }
 
+static void tty_buffer_release(struct tty_struct *tty);
+
 static inline void free_tty_struct(struct tty_struct *tty)
 {
+	tty_buffer_release(tty);
 	kfree(tty->write_buf);
 	kfree(tty);
 }
@@ -244,6 +247,13 @@ static void tty_set_termios_ldisc(struct tty_struct *tty, int num)
  *	This guards the refcounted line discipline lists. The lock
  *	must be taken with irqs off because there are hangup path
  *	callers who will do ldisc lookups and cannot sleep.
+ *
+ *	References to a tty's current ldisc don't use it: they are
+ *	counted in tty->ldisc_refs, and TTY_LDISC says whether new ones
+ *	may be taken. A taker bumps the count and then checks the bit; a
+ *	changer clears the bit and then waits for the count to drain.
+ *	Either the taker sees the bit gone and backs out, or the changer
+ *	sees its reference, so neither side needs a lock.
  */
  
 static DEFINE_SPINLOCK(tty_ldisc_lock);
@@ -340,21 +350,23 @@ static void tty_ldisc_assign(struct tty_struct *tty, struct tty_ldisc *ld)
  *	of tty_ldisc_ref
  */
 
+static inline void tty_ldisc_unref(struct tty_struct *tty)
+{
+	/* Only someone changing the ldisc waits for the count to drain */
+	if (atomic_dec_and_test(&tty->ldisc_refs) &&
+	    !test_bit(TTY_LDISC, &tty->flags))
+		wake_up(&tty_ldisc_wait);
+}
+
 static int tty_ldisc_try(struct tty_struct *tty)
 {
-	unsigned long flags;
-	struct tty_ldisc *ld;
-	int ret = 0;
-	
-	spin_lock_irqsave(&tty_ldisc_lock, flags);
-	ld = &tty->ldisc;
-	if(test_bit(TTY_LDISC, &tty->flags))
-	{
-		ld->refcount++;
-		ret = 1;
-	}
-	spin_unlock_irqrestore(&tty_ldisc_lock, flags);
-	return ret;
+	atomic_inc(&tty->ldisc_refs);
+	smp_mb__after_atomic_inc();
+	if (test_bit(TTY_LDISC, &tty->flags))
+		return 1;
+	/* Lost a race with tty_set_ldisc() or a final close */
+	tty_ldisc_unref(tty);
+	return 0;
 }
 
 /**
@@ -375,7 +387,7 @@ struct tty_ldisc *tty_ldisc_ref_wait(struct tty_struct *tty)
 {
 	/* wait_event is a macro */
 	wait_event(tty_ldisc_wait, tty_ldisc_try(tty));
-	if(tty->ldisc.refcount == 0)
+	if(atomic_read(&tty->ldisc_refs) <= 0)
 		printk(KERN_ERR "tty_ldisc_ref_wait\n");
 	return &tty->ldisc;
 }
@@ -410,19 +422,15 @@ EXPORT_SYMBOL_GPL(tty_ldisc_ref);
  
 void tty_ldisc_deref(struct tty_ldisc *ld)
 {
-	unsigned long flags;
+	struct tty_struct *tty;
 
 	if(ld == NULL)
 		BUG();
-		
-	spin_lock_irqsave(&tty_ldisc_lock, flags);
-	if(ld->refcount == 0)
+	tty = container_of(ld, struct tty_struct, ldisc);
+	if(atomic_read(&tty->ldisc_refs) <= 0)
 		printk(KERN_ERR "tty_ldisc_deref: no references.\n");
 	else
-		ld->refcount--;
-	if(ld->refcount == 0)
-		wake_up(&tty_ldisc_wait);
-	spin_unlock_irqrestore(&tty_ldisc_lock, flags);
+		tty_ldisc_unref(tty);
 }
 
 EXPORT_SYMBOL_GPL(tty_ldisc_deref);
@@ -459,14 +467,11 @@ static int tty_set_ldisc(struct tty_struct *tty, int ldisc)
 	struct	tty_ldisc o_ldisc;
 	char buf[64];
 	int work;
-	unsigned long flags;
 	struct tty_ldisc *ld;
 
 	if ((ldisc < N_TTY) || (ldisc >= NR_LDISCS))
 		return -EINVAL;
 
-restart:
-
 	if (tty->ldisc.num == ldisc)
 		return 0;	/* We are already in the desired discipline */
 	
@@ -487,31 +492,19 @@ restart:
 	/*
 	 *	Make sure we don't change while someone holds a
 	 *	reference to the line discipline. The TTY_LDISC bit
-	 *	prevents anyone taking a reference once it is clear.
-	 *	We need the lock to avoid racing reference takers.
+	 *	prevents anyone taking a reference once it is clear,
+	 *	so we only wait for those already out to be dropped.
 	 */
 	 
-	spin_lock_irqsave(&tty_ldisc_lock, flags);
-	if(tty->ldisc.refcount)
-	{
-		/* Free the new ldisc we grabbed. Must drop the lock
-		   first. */
-		spin_unlock_irqrestore(&tty_ldisc_lock, flags);
+	clear_bit(TTY_LDISC, &tty->flags);
+	smp_mb__after_clear_bit();
+	if (wait_event_interruptible(tty_ldisc_wait,
+			atomic_read(&tty->ldisc_refs) == 0) < 0) {
 		tty_ldisc_put(ldisc);
-		/*
-		 * There are several reasons we may be busy, including
-		 * random momentary I/O traffic. We must therefore
-		 * retry. We could distinguish between blocking ops
-		 * and retries if we made tty_ldisc_wait() smarter. That
-		 * is up for discussion.
-		 */
-		if(wait_event_interruptible(tty_ldisc_wait, tty->ldisc.refcount == 0) < 0)
-			return -ERESTARTSYS;			
-		goto restart;
+		tty_ldisc_enable(tty);
+		return -ERESTARTSYS;
 	}
-	clear_bit(TTY_LDISC, &tty->flags);	
 	clear_bit(TTY_DONT_FLIP, &tty->flags);
-	spin_unlock_irqrestore(&tty_ldisc_lock, flags);
 	
 	/*
 	 *	From this point on we know nobody has an ldisc
@@ -1023,8 +1016,77 @@ static ssize_t tty_read(struct file * file, char __user * buf, size_t count,
  * Split writes up in sane blocksizes to avoid
  * denial-of-service type attacks
  */
+#define TTY_WRITE_CHUNK		2048
+#define TTY_WRITE_CHUNK_MAX	65536
+
+/*
+ * How much N_TTY's output processing may grow what it is given: tabs
+ * expand to up to 8 spaces, and a newline to CR NL.
+ */
+static int tty_opost_expansion(struct tty_struct *tty)
+{
+	if (O_TABDLY(tty) == XTABS)
+		return 8;
+	if (O_ONLCR(tty))
+		return 2;
+	return 1;
+}
+
+/*
+ * Pick the chunk size for a write of @count bytes. It is as much as the
+ * driver says it can take right now once the ldisc has expanded it, but
+ * at least the traditional 2kB and never more than 64kB, so a VT or pty
+ * with room swallows a large write in one pass.
+ */
+static unsigned int tty_write_chunk(struct tty_struct *tty,
+				    struct tty_ldisc *ld, size_t count)
+{
+	unsigned int chunk = TTY_WRITE_CHUNK;
+	int room;
+
+	if (test_bit(TTY_NO_WRITE_SPLIT, &tty->flags))
+		chunk = TTY_WRITE_CHUNK_MAX;
+	else if (tty->driver->write_room) {
+		room = tty->driver->write_room(tty);
+		if (ld->num == N_TTY && O_OPOST(tty))
+			room /= tty_opost_expansion(tty);
+		if (room > TTY_WRITE_CHUNK_MAX)
+			room = TTY_WRITE_CHUNK_MAX;
+		if (room > chunk)
+			chunk = room;
+	}
+	if (count < chunk)
+		chunk = count;
+	return chunk;
+}
+
+/*
+ * Make tty->write_buf at least @chunk bytes. The buffer stays with the
+ * tty and only grows, in powers of two, so steady writers stop
+ * allocating. If a bigger one can't be had we make do with what we
+ * have. Returns the usable size, 0 if there is no buffer at all.
+ */
+static unsigned int tty_write_buf_get(struct tty_struct *tty, unsigned int chunk)
+{
+	unsigned int size = 1024;
+	unsigned char *buf;
+
+	/* write_buf/write_cnt is protected by the atomic_write semaphore */
+	if (tty->write_cnt >= chunk)
+		return chunk;
+	while (size < chunk)
+		size <<= 1;
+	buf = kmalloc(size, GFP_KERNEL);
+	if (!buf)
+		return min_t(unsigned int, tty->write_cnt, chunk);
+	kfree(tty->write_buf);
+	tty->write_cnt = size;
+	tty->write_buf = buf;
+	return chunk;
+}
+
 static inline ssize_t do_tty_write(
-	ssize_t (*write)(struct tty_struct *, struct file *, const unsigned char *, size_t),
+	struct tty_ldisc *ld,
 	struct tty_struct *tty,
 	struct file *file,
 	const char __user *buf,
@@ -1042,35 +1104,22 @@ static inline ssize_t do_tty_write(
 	 * simplifies low-level drivers immensely, since they
 	 * don't have locking issues and user mode accesses.
 	 *
-	 * But if TTY_NO_WRITE_SPLIT is set, we should use a
-	 * big chunk-size..
+	 * The chunk is sized from the driver's write_room and
+	 * what the ldisc can take, see tty_write_chunk().
 	 *
-	 * The default chunk-size is 2kB, because the NTTY
-	 * layer has problems with bigger chunks. It will
-	 * claim to be able to handle more characters than
-	 * it actually does.
+	 * N_TTY needs no big kernel lock: its write_chan() state
+	 * (column, the opost buffer) is only changed by writers,
+	 * which atomic_write serialises, and by echo from the
+	 * receive path, which never ran under the BKL. The drivers
+	 * it calls are called from that path too; con_write() takes
+	 * the display's vt_sem and pty_write() hands straight to the
+	 * other side's receive_buf(). Other disciplines have not been
+	 * audited and keep the BKL.
 	 */
-	chunk = 2048;
-	if (test_bit(TTY_NO_WRITE_SPLIT, &tty->flags))
-		chunk = 65536;
-	if (count < chunk)
-		chunk = count;
-
-	/* write_buf/write_cnt is protected by the atomic_write semaphore */
-	if (tty->write_cnt < chunk) {
-		unsigned char *buf;
-
-		if (chunk < 1024)
-			chunk = 1024;
-
-		buf = kmalloc(chunk, GFP_KERNEL);
-		if (!buf) {
-			up(&tty->atomic_write);
-			return -ENOMEM;
-		}
-		kfree(tty->write_buf);
-		tty->write_cnt = chunk;
-		tty->write_buf = buf;
+	chunk = tty_write_buf_get(tty, tty_write_chunk(tty, ld, count));
+	if (!chunk && count) {
+		up(&tty->atomic_write);
+		return -ENOMEM;
 	}
 
 	/* Do the write .. */
@@ -1081,9 +1130,13 @@ static inline ssize_t do_tty_write(
 		ret = -EFAULT;
 		if (copy_from_user(tty->write_buf, buf, size))
 			break;
-		lock_kernel();
-		ret = write(tty, file, tty->write_buf, size);
-		unlock_kernel();
+		if (ld->num == N_TTY)
+			ret = ld->write(tty, file, tty->write_buf, size);
+		else {
+			lock_kernel();
+			ret = ld->write(tty, file, tty->write_buf, size);
+			unlock_kernel();
+		}
 		if (ret <= 0)
 			break;
 		written += ret;
@@ -1124,7 +1177,7 @@ static ssize_t tty_write(struct file * file, const char __user * buf, size_t cou
 	if (!ld->write)
 		ret = -EIO;
 	else
-		ret = do_tty_write(ld->write, tty, file, buf, count);
+		ret = do_tty_write(ld, tty, file, buf, count);
 	tty_ldisc_deref(ld);
 	return ret;
 }
@@ -1466,7 +1519,6 @@ static void release_dev(struct file * filp)
 	int	devpts_master, devpts;
 	int	idx;
 	char	buf[64];
-	unsigned long flags;
 	
 	tty = (struct tty_struct *)filp->private_data;
 	if (tty_paranoia_check(tty, filp->f_dentry->d_inode, "release_dev"))
@@ -1694,14 +1746,7 @@ static void release_dev(struct file * filp)
 	 * side waiters as the file is closing so user count on the file
 	 * side is zero.
 	 */
-	spin_lock_irqsave(&tty_ldisc_lock, flags);
-	while(tty->ldisc.refcount)
-	{
-		spin_unlock_irqrestore(&tty_ldisc_lock, flags);
-		wait_event(tty_ldisc_wait, tty->ldisc.refcount == 0);
-		spin_lock_irqsave(&tty_ldisc_lock, flags);
-	}
-	spin_unlock_irqrestore(&tty_ldisc_lock, flags);
+	wait_event(tty_ldisc_wait, atomic_read(&tty->ldisc_refs) == 0);
 	/*
 	 * Shutdown the current line discipline, and reset it to N_TTY.
 	 * N.B. why reset ldisc when we're releasing the memory??
@@ -2022,11 +2067,14 @@ static int tiocswinsz(struct tty_struct *tty, struct tty_struct *real_tty,
 		return 0;
 #ifdef CONFIG_VT
 	if (tty->driver->type == TTY_DRIVER_TYPE_CONSOLE) {
-		int rc;
+		struct vc_data *vc = tty->driver_data;
+		int rc = 0;
 
-		acquire_console_sem();
-		rc = vc_resize(tty->driver_data, tmp_ws.ws_col, tmp_ws.ws_row);
-		release_console_sem();
+		if (vc) {
+			acquire_vt_sem(vc->display_fg);
+			rc = vc_resize(vc, tmp_ws.ws_col, tmp_ws.ws_row);
+			release_vt_sem(vc->display_fg);
+		}
 		if (rc)
 			return -ENXIO;
 	}
@@ -2486,30 +2534,149 @@ void do_SAK(struct tty_struct *tty)
 EXPORT_SYMBOL(do_SAK);
 
 /*
- * This routine is called out of the software interrupt to flush data
- * from the flip buffer to the line discipline. 
+ * Flip buffer chain. See the comment above struct tty_flip_buffer: the
+ * driver appends at flip.tail, flush_to_ldisc() drains flip.head, and
+ * the consumer never locks the producers out. flip.lock serialises the
+ * producers and covers the spare pool.
  */
- 
-static void flush_to_ldisc(void *private_)
+
+/* Called with flip.lock held */
+static struct tty_buffer *tty_buffer_alloc(struct tty_struct *tty, int size)
+{
+	struct tty_flip_buffer *flip = &tty->flip;
+	struct tty_buffer *b = NULL;
+
+	if (size <= TTY_FLIPBUF_SIZE) {
+		size = TTY_FLIPBUF_SIZE;
+		if ((b = flip->free) != NULL) {
+			flip->free = b->next;
+			flip->nfree--;
+		}
+	} else {
+		size = (size + TTY_FLIPBUF_SIZE - 1) & ~(TTY_FLIPBUF_SIZE - 1);
+		if (size > TTY_BUFFER_MAX)
+			size = TTY_BUFFER_MAX;
+	}
+	if (!b) {
+		if (atomic_read(&flip->memory_used) + size > TTY_BUFFER_LIMIT)
+			return NULL;
+		b = kmalloc(sizeof(*b) + 2 * size, GFP_ATOMIC);
+		if (!b)
+			return NULL;
+		atomic_add(size, &flip->memory_used);
+	}
+	b->next = NULL;
+	b->size = size;
+	b->used = b->commit = b->read = 0;
+	b->char_buf = (unsigned char *) b->data;
+	b->flag_buf = (char *) b->data + size;
+	return b;
+}
+
+static void tty_buffer_free(struct tty_struct *tty, struct tty_buffer *b)
+{
+	struct tty_flip_buffer *flip = &tty->flip;
+	unsigned long flags;
+
+	if (b->size == TTY_FLIPBUF_SIZE) {
+		spin_lock_irqsave(&flip->lock, flags);
+		if (flip->nfree < TTY_BUFFER_POOL) {
+			b->next = flip->free;
+			flip->free = b;
+			flip->nfree++;
+			b = NULL;
+		}
+		spin_unlock_irqrestore(&flip->lock, flags);
+		if (!b)
+			return;
+	}
+	atomic_sub(b->size, &flip->memory_used);
+	kfree(b);
+}
+
+/* Final close: neither end can be running any more */
+static void tty_buffer_release(struct tty_struct *tty)
+{
+	struct tty_buffer *b;
+
+	while ((b = tty->flip.head) != NULL) {
+		tty->flip.head = b->next;
+		kfree(b);
+	}
+	while ((b = tty->flip.free) != NULL) {
+		tty->flip.free = b->next;
+		kfree(b);
+	}
+	tty->flip.tail = NULL;
+	tty->flip.nfree = 0;
+	atomic_set(&tty->flip.memory_used, 0);
+}
+
+/* Called with flip.lock held */
+static int __tty_buffer_request_room(struct tty_struct *tty, int size)
+{
+	struct tty_buffer *b = tty->flip.tail, *n;
+
+	if (b && b->size - b->used >= size)
+		return size;
+	n = tty_buffer_alloc(tty, size);
+	if (!n)
+		return b ? b->size - b->used : 0;
+	/* n must look initialized before the consumer can reach it */
+	smp_wmb();
+	if (b)
+		b->next = n;
+	else
+		tty->flip.head = n;
+	tty->flip.tail = n;
+	return min(size, n->size);
+}
+
+/**
+ *	tty_buffer_request_room	-	make room at the tail
+ *	@tty: tty to queue for
+ *	@size: characters wanted
+ *
+ *	Make sure the tail buffer can take @size more characters, starting
+ *	a new one if it can't. Returns how many it can take, which is less
+ *	than @size when the tty is at its memory limit. Takes flip.lock,
+ *	which every producer holds while it queues and which also covers
+ *	the buffer pool; flush_to_ldisc() consumes without it. The lock is
+ *	dropped on return, so a driver that then fills flip.tail itself
+ *	must not share the tty with another producer.
+ */
+
+int tty_buffer_request_room(struct tty_struct *tty, int size)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&tty->flip.lock, flags);
+	ret = __tty_buffer_request_room(tty, size);
+	spin_unlock_irqrestore(&tty->flip.lock, flags);
+	return ret;
+}
+
+EXPORT_SYMBOL(tty_buffer_request_room);
+
+static inline int tty_buffer_pending(struct tty_struct *tty)
+{
+	struct tty_buffer *b = tty->flip.head;
+
+	return tty->flip.count || (b && (b->commit != b->read || b->next));
+}
+
+/*
+ * Hand what an old style driver queued with tty_insert_flip_char() to
+ * the ldisc, flipping halves under read_lock as it always did.
+ */
+static void flush_old_flip(struct tty_struct *tty, struct tty_ldisc *disc)
 {
-	struct tty_struct *tty = (struct tty_struct *) private_;
 	unsigned char	*cp;
 	char		*fp;
 	int		count;
 	unsigned long 	flags;
-	struct tty_ldisc *disc;
-
-	disc = tty_ldisc_ref(tty);
-	if (disc == NULL)	/*  !TTY_LDISC */
-		return;
 
-	if (test_bit(TTY_DONT_FLIP, &tty->flags)) {
-		/*
-		 * Do it after the next timer tick:
-		 */
-		schedule_delayed_work(&tty->flip.work, 1);
-		goto out;
-	}
 	spin_lock_irqsave(&tty->read_lock, flags);
 	if (tty->flip.buf_num) {
 		cp = tty->flip.char_buf + TTY_FLIPBUF_SIZE;
@@ -2529,6 +2696,71 @@ static void flush_to_ldisc(void *private_)
 	spin_unlock_irqrestore(&tty->read_lock, flags);
 
 	disc->receive_buf(tty, cp, fp, count);
+}
+
+/*
+ * This routine is called out of the software interrupt to flush data
+ * from the flip buffer to the line discipline. Whatever has been
+ * committed is handed over a buffer at a time, as much as the ldisc
+ * has room for; the rest waits for the next tick.
+ */
+ 
+static void flush_to_ldisc(void *private_)
+{
+	struct tty_struct *tty = (struct tty_struct *) private_;
+	struct tty_buffer *b, *next;
+	int		count, room, held = 0;
+	struct tty_ldisc *disc;
+
+	disc = tty_ldisc_ref(tty);
+	if (disc == NULL)	/*  !TTY_LDISC */
+		return;
+
+	if (test_bit(TTY_DONT_FLIP, &tty->flags)) {
+		/*
+		 * Do it after the next timer tick:
+		 */
+		schedule_delayed_work(&tty->flip.work, 1);
+		goto out;
+	}
+	/* The work may run on two CPUs at once: only one consumes */
+	if (test_and_set_bit(TTY_FLUSHING, &tty->flags))
+		goto out;
+again:
+	if (tty->flip.count)
+		flush_old_flip(tty, disc);
+	while ((b = tty->flip.head) != NULL) {
+		next = b->next;
+		smp_rmb();		/* commit is final once next is set */
+		count = b->commit - b->read;
+		if (!count) {
+			if (!next)
+				break;
+			tty->flip.head = next;
+			tty_buffer_free(tty, b);
+			continue;
+		}
+		if (disc->receive_room) {
+			room = disc->receive_room(tty);
+			if (count > room)
+				count = room;
+			if (count <= 0) {
+				schedule_delayed_work(&tty->flip.work, 1);
+				held = 1;
+				break;
+			}
+		}
+		smp_rmb();		/* the characters before commit */
+		disc->receive_buf(tty, b->char_buf + b->read,
+				  b->flag_buf + b->read, count);
+		b->read += count;
+	}
+	clear_bit(TTY_FLUSHING, &tty->flags);
+	smp_mb__after_clear_bit();
+	/* A push that saw us busy left its characters to us */
+	if (!held && tty_buffer_pending(tty) &&
+	    !test_and_set_bit(TTY_FLUSHING, &tty->flags))
+		goto again;
 out:
 	tty_ldisc_deref(disc);
 }
@@ -2614,8 +2846,9 @@ EXPORT_SYMBOL(tty_get_baud_rate);
  *	Queue a push of the terminal flip buffers to the line discipline. This
  *	function must not be called from IRQ context if tty->low_latency is set.
  *
- *	In the event of the queue being busy for flipping the work will be
- *	held off and retried later.
+ *	The push no longer waits for the next tick: the driver keeps
+ *	appending while the ldisc drains, so there is nothing to gain by
+ *	letting characters pile up.
  */
 
 void tty_flip_buffer_push(struct tty_struct *tty)
@@ -2623,11 +2856,81 @@ void tty_flip_buffer_push(struct tty_struct *tty)
 	if (tty->low_latency)
 		flush_to_ldisc((void *) tty);
 	else
-		schedule_delayed_work(&tty->flip.work, 1);
+		schedule_work(&tty->flip.work);
 }
 
 EXPORT_SYMBOL(tty_flip_buffer_push);
 
+/**
+ *	tty_insert_flip_string	-	add characters to the flip buffer
+ *	@tty: tty to queue for
+ *	@chars: characters
+ *	@count: number of characters
+ *
+ *	Queue a block of normal characters in one go, spilling into new
+ *	buffers as needed. Characters are only dropped once the tty has
+ *	TTY_BUFFER_LIMIT queued; returns the number queued. The caller
+ *	pushes the buffer.
+ */
+
+int tty_insert_flip_string(struct tty_struct *tty, const unsigned char *chars, int count)
+{
+	struct tty_buffer *b;
+	unsigned long flags;
+	int copied = 0, space;
+
+	spin_lock_irqsave(&tty->flip.lock, flags);
+	while (copied < count) {
+		space = __tty_buffer_request_room(tty, count - copied);
+		if (space <= 0)
+			break;
+		b = tty->flip.tail;
+		memcpy(b->char_buf + b->used, chars + copied, space);
+		memset(b->flag_buf + b->used, TTY_NORMAL, space);
+		b->used += space;
+		copied += space;
+		smp_wmb();
+		b->commit = b->used;
+	}
+	tty->flip.dropped += count - copied;
+	spin_unlock_irqrestore(&tty->flip.lock, flags);
+	return copied;
+}
+
+EXPORT_SYMBOL(tty_insert_flip_string);
+
+/**
+ *	tty_insert_flip_flag	-	add one character to the flip buffer
+ *	@tty: tty to queue for
+ *	@ch: character
+ *	@flag: TTY_NORMAL, TTY_BREAK, TTY_PARITY...
+ *
+ *	Returns 1 if the character was queued, 0 if the tty is at its
+ *	memory limit. The caller pushes the buffer.
+ */
+
+int tty_insert_flip_flag(struct tty_struct *tty, unsigned char ch, char flag)
+{
+	struct tty_buffer *b;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&tty->flip.lock, flags);
+	if (__tty_buffer_request_room(tty, 1) > 0) {
+		b = tty->flip.tail;
+		b->char_buf[b->used] = ch;
+		b->flag_buf[b->used++] = flag;
+		smp_wmb();
+		b->commit = b->used;
+		ret = 1;
+	} else
+		tty->flip.dropped++;
+	spin_unlock_irqrestore(&tty->flip.lock, flags);
+	return ret;
+}
+
+EXPORT_SYMBOL(tty_insert_flip_flag);
+
 /*
  * This subroutine initializes a tty structure.
  */
@@ -2638,6 +2941,7 @@ static void initialize_tty_struct(struct tty_struct *tty)
 	tty_ldisc_assign(tty, tty_ldisc_get(N_TTY));
 	tty->pgrp = -1;
 	tty->overrun_time = jiffies;
+	spin_lock_init(&tty->flip.lock);
 	tty->flip.char_buf_ptr = tty->flip.char_buf;
 	tty->flip.flag_buf_ptr = tty->flip.flag_buf;
 	INIT_WORK(&tty->flip.work, flush_to_ldisc, tty);
@@ -14,6 +14,20 @@
  * This replaces screendump and part of selection, so that the system
  * administrator can control access using file system permissions.
  *
+ * /dev/vcsaN can also be mmap()ed read-only. The mapping starts with a
+ *	32-bit generation counter and the 32-bit size of the image that
+ *	follows at offset 8, laid out exactly as read() returns it. The
+ *	counter is odd while the image is being updated and bumped on every
+ *	update, so a reader copies the image while the counter is even and
+ *	unchanged, and does not need a syscall at all to notice nothing
+ *	changed. A size of 0 means the console was resized beyond the
+ *	mapping or went away; map it again.
+ *
+ * All of them can be poll()ed: they become readable when the screen or
+ *	the cursor changed since the file was last read. VCS_GETDELTA (see
+ *	<linux/vcs.h>) tells which rows changed, so a reader only needs to
+ *	pread() those.
+ *
  * aeb@cwi.nl - efter Friedas begravelse - 950211
  *
  * machek@k332.feld.cvut.cz - modified not to send characters to wrong console
@@ -36,11 +50,34 @@
 #include <linux/console.h>
 #include <linux/smp_lock.h>
 #include <linux/device.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/poll.h>
+#include <linux/vcs.h>
 #include <asm/uaccess.h>
 #include <asm/byteorder.h>
 #include <asm/unaligned.h>
 
 #define HEADER_SIZE	4
+#define SHADOW_HDR	8		/* generation, size */
+#define SHADOW_DELAY	(HZ / 50)	/* Batch updates of the mmap shadow */
+
+struct vcs_shadow {
+	struct vc_data *vc;		/* NULL once the VC is gone */
+	struct vt_struct *vt;		/* Display vc was on; outlives it */
+	void *buf;			/* vmalloc()ed, mapped to userspace */
+	unsigned long size;		/* Bytes allocated for buf */
+	atomic_t count;			/* Mappings */
+	atomic_t ref;			/* One for the mappings, one if work is queued */
+	unsigned long dirty;
+	struct work_struct work;
+};
+
+struct vcs_rows {
+	unsigned int rows, cols;	/* Geometry of last */
+	u16 *last;			/* Screen as of the last VCS_GETDELTA */
+	unsigned int *seq;		/* vc_delta_seq when each row last changed */
+};
 
 unsigned short *screen_pos(struct vc_data *vc, int w_offset, int viewed)
 {
@@ -85,6 +122,361 @@ vcs_size(struct vc_data *vc, unsigned long attr)
 	return size;
 }
 
+/*
+ *	mmap() shadow of /dev/vcsa
+ */
+static void vcs_shadow_update(struct vcs_shadow *sh)
+{
+	struct vc_data *vc = sh->vc;
+	u32 *hdr = sh->buf;
+	u32 gen = hdr[0];
+	unsigned char *head = sh->buf + SHADOW_HDR;
+	u16 *q = sh->buf + SHADOW_HDR + HEADER_SIZE;
+	int size, viewed, y, x;
+
+	WARN_VT_UNLOCKED(sh->vt);
+
+	hdr[0] = gen + 1;
+	smp_wmb();
+	size = vc ? vcs_size(vc, 1) : 0;
+	if (size > sh->size - SHADOW_HDR)
+		size = 0;
+	hdr[1] = size;
+	if (size) {
+		viewed = IS_VISIBLE;
+		head[0] = (char)vc->vc_rows;
+		head[1] = (char)vc->vc_cols;
+		getconsxy(vc, head + 2);
+		for (y = 0; y < vc->vc_rows; y++) {
+			u16 *org = screen_pos(vc, y * vc->vc_cols, viewed);
+
+			for (x = 0; x < vc->vc_cols; x++)
+				*q++ = vcs_scr_readw(vc, org++);
+		}
+	}
+	smp_wmb();
+	hdr[0] = gen + 2;
+}
+
+static void vcs_shadow_put(struct vcs_shadow *sh)
+{
+	if (atomic_dec_and_test(&sh->ref)) {
+		vfree(sh->buf);
+		kfree(sh);
+	}
+}
+
+static void vcs_shadow_work(void *private)
+{
+	struct vcs_shadow *sh = private;
+
+	acquire_vt_sem(sh->vt);
+	clear_bit(0, &sh->dirty);
+	if (sh->vc)
+		vcs_shadow_update(sh);
+	release_vt_sem(sh->vt);
+	vcs_shadow_put(sh);
+}
+
+/*
+ * Called whenever what /dev/vcsa would show for @vc changes: its
+ * contents, its cursor, or whether it is in front, blanked or
+ * scrolled back.
+ */
+void __vcs_changed(struct vc_data *vc)
+{
+	struct vcs_shadow *sh = vc->vc_shadow;
+
+	if (sh && !test_and_set_bit(0, &sh->dirty)) {
+		atomic_inc(&sh->ref);
+		schedule_delayed_work(&sh->work, SHADOW_DELAY);
+	}
+	wake_up_interruptible(&vc->vc_vcs_wait);
+}
+
+static void vcs_rows_free(struct vc_data *vc)
+{
+	struct vcs_rows *r = vc->vc_vcs_rows;
+
+	if (!r)
+		return;
+	vc->vc_vcs_rows = NULL;
+	kfree(r->last);
+	kfree(r->seq);
+	kfree(r);
+}
+
+/*
+ * The VC is going away; leave its mappings with a zero size image and
+ * let pollers notice.
+ */
+void vcs_detach(struct vc_data *vc)
+{
+	struct vcs_shadow *sh = vc->vc_shadow;
+
+	WARN_VT_UNLOCKED(vc->display_fg);
+
+	vcs_rows_free(vc);
+	wake_up_interruptible(&vc->vc_vcs_wait);
+	if (!sh)
+		return;
+	sh->vc = NULL;
+	vc->vc_shadow = NULL;
+	vcs_shadow_update(sh);
+}
+
+/*
+ * Rows are found changed by comparing against the screen as it was on
+ * the previous VCS_GETDELTA, by whichever file, so the output paths
+ * need not track them. When we notice changes vc_delta_seq is bumped
+ * first and the rows are stamped with the new one, which no caller has
+ * been handed yet; so a row that changed after a caller's seq always
+ * compares newer, however many other callers looked in between. This
+ * is a counter of its own: noticing a change late is no change to the
+ * screen, so pollers are not woken for it.
+ */
+static int vcs_rows_update(struct vc_data *vc)
+{
+	struct vcs_rows *r = vc->vc_vcs_rows;
+	int viewed = IS_VISIBLE, bumped = 0;
+	unsigned int y, x;
+
+	if (r && (r->rows != vc->vc_rows || r->cols != vc->vc_cols))
+		vcs_rows_free(vc);
+	if (!vc->vc_vcs_rows) {
+		r = kmalloc(sizeof(*r), GFP_KERNEL);
+		if (!r)
+			return -ENOMEM;
+		r->rows = vc->vc_rows;
+		r->cols = vc->vc_cols;
+		r->last = kmalloc(vc->vc_screenbuf_size, GFP_KERNEL);
+		r->seq = kmalloc(r->rows * sizeof(*r->seq), GFP_KERNEL);
+		if (!r->last || !r->seq) {
+			kfree(r->last);
+			kfree(r->seq);
+			kfree(r);
+			return -ENOMEM;
+		}
+		/* Everything is new to a fresh tracker */
+		vc->vc_delta_seq++;
+		bumped = 1;
+		memset(r->last, 0, vc->vc_screenbuf_size);
+		for (y = 0; y < r->rows; y++)
+			r->seq[y] = vc->vc_delta_seq;
+		vc->vc_vcs_rows = r;
+	}
+	for (y = 0; y < r->rows; y++) {
+		u16 *org = screen_pos(vc, y * r->cols, viewed);
+		u16 *q = r->last + y * r->cols;
+		int changed = 0;
+
+		for (x = 0; x < r->cols; x++, org++, q++) {
+			u16 c = vcs_scr_readw(vc, org);
+
+			if (*q != c) {
+				*q = c;
+				changed = 1;
+			}
+		}
+		if (!changed)
+			continue;
+		if (!bumped) {
+			vc->vc_delta_seq++;
+			bumped = 1;
+		}
+		r->seq[y] = vc->vc_delta_seq;
+	}
+	return 0;
+}
+
+static int vcs_getdelta(struct vc_data *vc, struct vcs_delta __user *arg)
+{
+	struct vcs_delta d;
+	unsigned int y;
+	int ret;
+
+	if (copy_from_user(&d, arg, sizeof(d)))
+		return -EFAULT;
+	memset(d.rows, 0, sizeof(d.rows));
+	d.flags = 0;
+
+	acquire_vt_sem(vc->display_fg);
+	ret = vc_screen_need(vc, GFP_KERNEL);
+	if (!ret)
+		ret = vcs_rows_update(vc);
+	if (!ret) {
+		struct vcs_rows *r = vc->vc_vcs_rows;
+
+		for (y = 0; y < r->rows; y++) {
+			if ((int)(r->seq[y] - d.seq) <= 0)
+				continue;
+			if (y < VCS_DELTA_ROWS)
+				d.rows[y >> 3] |= 1 << (y & 7);
+			else
+				d.flags |= VCS_DELTA_ALL;
+		}
+		d.seq = vc->vc_delta_seq;
+	}
+	release_vt_sem(vc->display_fg);
+
+	if (!ret && copy_to_user(arg, &d, sizeof(d)))
+		ret = -EFAULT;
+	return ret;
+}
+
+static int vcs_ioctl(struct inode *inode, struct file *file,
+		     unsigned int cmd, unsigned long arg)
+{
+	struct vc_data *vc = file->private_data;
+
+	if (!vc)
+		return -ENXIO;
+	switch (cmd) {
+	case VCS_GETDELTA:
+		return vcs_getdelta(vc, (struct vcs_delta __user *)arg);
+	}
+	return -ENOTTY;
+}
+
+/* Readable once the screen changed since this file last read it */
+static unsigned int vcs_poll(struct file *file, poll_table *wait)
+{
+	struct vc_data *vc = file->private_data;
+
+	if (!vc)
+		return POLLERR | POLLHUP;
+	poll_wait(file, &vc->vc_vcs_wait, wait);
+	if (file->f_version != vc->vc_vcs_seq)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static struct vcs_shadow *vcs_shadow_alloc(struct vc_data *vc)
+{
+	struct vcs_shadow *sh;
+
+	sh = kmalloc(sizeof(*sh), GFP_KERNEL);
+	if (!sh)
+		return NULL;
+	memset(sh, 0, sizeof(*sh));
+	sh->size = PAGE_ALIGN(SHADOW_HDR + vcs_size(vc, 1));
+	sh->buf = vmalloc_32(sh->size);
+	if (!sh->buf) {
+		kfree(sh);
+		return NULL;
+	}
+	memset(sh->buf, 0, sh->size);
+	sh->vc = vc;
+	sh->vt = vc->display_fg;
+	atomic_set(&sh->ref, 1);
+	INIT_WORK(&sh->work, vcs_shadow_work, sh);
+	vcs_shadow_update(sh);
+	return sh;
+}
+
+static void vcs_vma_open(struct vm_area_struct *vma)
+{
+	struct vcs_shadow *sh = vma->vm_private_data;
+
+	atomic_inc(&sh->count);
+}
+
+static void vcs_vma_close(struct vm_area_struct *vma)
+{
+	struct vcs_shadow *sh = vma->vm_private_data;
+
+	acquire_vt_sem(sh->vt);
+	if (!atomic_dec_and_test(&sh->count)) {
+		release_vt_sem(sh->vt);
+		return;
+	}
+	if (sh->vc)
+		sh->vc->vc_shadow = NULL;
+	sh->vc = NULL;
+	release_vt_sem(sh->vt);
+
+	/*
+	 * No waiting for keventd here, we hold mmap_sem: if the work is
+	 * already running or past its timer, it frees the shadow itself.
+	 */
+	if (cancel_delayed_work(&sh->work))
+		vcs_shadow_put(sh);
+	vcs_shadow_put(sh);
+}
+
+static struct page *vcs_vma_nopage(struct vm_area_struct *vma,
+				   unsigned long address, int *type)
+{
+	struct vcs_shadow *sh = vma->vm_private_data;
+	unsigned long offset = address - vma->vm_start;
+	struct page *page;
+
+	if (offset >= sh->size)
+		return NOPAGE_SIGBUS;
+	page = vmalloc_to_page(sh->buf + offset);
+	get_page(page);
+	if (type)
+		*type = VM_FAULT_MINOR;
+	return page;
+}
+
+static struct vm_operations_struct vcs_vm_ops = {
+	.open	= vcs_vma_open,
+	.close	= vcs_vma_close,
+	.nopage	= vcs_vma_nopage,
+};
+
+static int vcs_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	struct vc_data *vc = file->private_data;
+	struct vcs_shadow *sh;
+	int ret = 0;
+
+	if (!vc)
+		return -ENXIO;
+	if (!(iminor(inode) & 128))
+		return -ENODEV;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	acquire_vt_sem(vc->display_fg);
+	/* A mapped VC keeps its buffer; see vc_screen_drop() */
+	if (vc_screen_need(vc, GFP_KERNEL)) {
+		ret = -ENOMEM;
+		goto unlock_out;
+	}
+	sh = vc->vc_shadow;
+	if (!sh) {
+		sh = vcs_shadow_alloc(vc);
+		if (!sh) {
+			ret = -ENOMEM;
+			goto unlock_out;
+		}
+		vc->vc_shadow = sh;
+	}
+	if (vma->vm_end - vma->vm_start > sh->size) {
+		/* A fresh shadow is only ever attached with its mapping */
+		if (!atomic_read(&sh->count)) {
+			vc->vc_shadow = NULL;
+			vfree(sh->buf);
+			kfree(sh);
+		}
+		ret = -EINVAL;
+		goto unlock_out;
+	}
+	atomic_inc(&sh->count);
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_RESERVED;
+	vma->vm_ops = &vcs_vm_ops;
+	vma->vm_private_data = sh;
+unlock_out:
+	release_vt_sem(vc->display_fg);
+	return ret;
+}
+
 static loff_t vcs_lseek(struct file *file, loff_t offset, int orig)
 {
 	struct inode *inode = file->f_dentry->d_inode;
@@ -133,15 +525,16 @@ vcs_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 	pos = *ppos;
 	/* 
 	 * Select the proper current console and verify
-	 * sanity of the situation under the console lock.
+	 * sanity of the situation under the display lock.
 	 */
-	acquire_console_sem();
+	acquire_vt_sem(vc->display_fg);
 
 	if (IS_VISIBLE) {
 		viewed = 1;
 	} else {
 		viewed = 0;
 	}
+	file->f_version = vc->vc_vcs_seq;
 
 	ret = -EINVAL;
 	if (pos < 0)
@@ -163,6 +556,13 @@ vcs_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 			break;
 		if (count > size - pos)
 			count = size - pos;
+		/* The buffer may have been reclaimed while we slept */
+		if (vc_screen_need(vc, GFP_KERNEL)) {
+			ret = -ENOMEM;
+			break;
+		}
+		/* Read the live screen, not scrollback drawn over it */
+		history_unview(vc);
 
 		this_round = count;
 		if (this_round > BUF_SIZE)
@@ -251,16 +651,16 @@ vcs_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 			}
 		}
 
-		/* Finally, release the console semaphore while we push
+		/* Finally, release the display lock while we push
 		 * all the data to userspace from our temporary buffer.
 		 *
 		 * AKPM: Even though it's a semaphore, we should drop it because
 		 * the pagefault handling code may want to call printk().
 		 */
 
-		release_console_sem();
+		release_vt_sem(vc->display_fg);
 		ret = copy_to_user(buf, con_buf_start, orig_count);
-		acquire_console_sem();
+		acquire_vt_sem(vc->display_fg);
 
 		if (ret) {
 			read += (orig_count - ret);
@@ -276,7 +676,7 @@ vcs_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 	if (read)
 		ret = read;
 unlock_out:
-	release_console_sem();
+	release_vt_sem(vc->display_fg);
 	up(&vc->display_fg->lock);
 	return ret;
 }
@@ -299,9 +699,9 @@ vcs_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 
 	/* 
 	 * Select the proper current console and verify
-	 * sanity of the situation under the console lock.
+	 * sanity of the situation under the display lock.
 	 */
-	acquire_console_sem();
+	acquire_vt_sem(vc->display_fg);
 
 	pos = *ppos;
 	if (IS_VISIBLE) {
@@ -325,12 +725,12 @@ vcs_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 		if (this_round > BUF_SIZE)
 			this_round = BUF_SIZE;
 
-		/* Temporarily drop the console lock so that we can read
+		/* Temporarily drop the display lock so that we can read
 		 * in the write data from userspace safely.
 		 */
-		release_console_sem();
+		release_vt_sem(vc->display_fg);
 		ret = copy_from_user(vc->display_fg->con_buf, buf, this_round);
-		acquire_console_sem();
+		acquire_vt_sem(vc->display_fg);
 
 		if (ret) {
 			this_round -= ret;
@@ -355,6 +755,13 @@ vcs_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 			break;
 		if (this_round > size - pos)
 			this_round = size - pos;
+		if (vc_screen_need(vc, GFP_KERNEL)) {
+			if (written)
+				break;
+			ret = -ENOMEM;
+			goto unlock_out;
+		}
+		history_unview(vc);
 
 		/* OK, now actually push the write to the console
 		 * under the lock using the local kernel buffer.
@@ -451,11 +858,12 @@ vcs_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 		if (org0)
 			update_region(vc, (unsigned long)(org0), org - org0);
 	}
+	vcs_changed(vc);
 	*ppos += written;
 	ret = written;
 
 unlock_out:
-	release_console_sem();
+	release_vt_sem(vc->display_fg);
 	up(&vc->display_fg->lock);
 	return ret;
 }
@@ -469,6 +877,8 @@ vcs_open(struct inode *inode, struct file *filp)
 	if (!vc)
 		return -ENXIO;
 	filp->private_data = vc;
+	/* Poll readable until the first read */
+	filp->f_version = vc->vc_vcs_seq - 1;
 	return 0;
 }
 
@@ -477,6 +887,9 @@ static struct file_operations vcs_fops = {
 	.read		= vcs_read,
 	.write		= vcs_write,
 	.open		= vcs_open,
+	.mmap		= vcs_mmap,
+	.poll		= vcs_poll,
+	.ioctl		= vcs_ioctl,
 };
 
 static struct class_simple *vc_class;
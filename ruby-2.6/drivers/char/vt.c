@@ -91,6 +91,7 @@
 #include <linux/vt_kern.h>
 #include <linux/selection.h>
 #include <linux/tiocl.h>
+#include <linux/vt_event.h>
 #include <linux/consolemap.h>
 #include <linux/timer.h>
 #include <linux/interrupt.h>
@@ -99,6 +100,7 @@
 #include <linux/bootmem.h>
 #include <linux/pm.h>
 #include <linux/font.h>
+#include <linux/percpu.h>
 
 #include <asm/io.h>
 #include <asm/system.h>
@@ -170,7 +172,6 @@ unsigned char color_table[] = { 0, 4, 2, 6, 1, 5, 3, 7,
  * mainly for the privacy of braille terminal users.
  */
 static int ignore_poke;
-int do_poke_blanked_console;
 
 /*
  * Hook so that the power management routines can (un)blank
@@ -189,6 +190,7 @@ int (*console_blank_hook)(int);
 
 #define sw vc->display_fg->vt_sw
 
+
 /*
  * Console cursor handling
  */
@@ -223,6 +225,7 @@ static void hide_softcursor(struct vc_data *vc)
 
 void hide_cursor(struct vc_data *vc)
 {
+	history_unview(vc);
 	if (vc == sel_cons)
 		clear_selection();
 	sw->con_cursor(vc, CM_ERASE);
@@ -231,7 +234,8 @@ void hide_cursor(struct vc_data *vc)
 
 void set_cursor(struct vc_data *vc)
 {
-    if (!IS_VISIBLE || vc->display_fg->vt_blanked || vc->vc_mode == KD_GRAPHICS)
+    if (!IS_VISIBLE || vc->display_fg->vt_blanked || vc->vc_mode == KD_GRAPHICS ||
+	vc->vc_hist_view)
 	return;
     if (vc->vc_dectcem) {
 	if (vc == sel_cons)
@@ -272,7 +276,7 @@ void gotoxy(struct vc_data *vc, int new_x, int new_y)
 		vc->vc_y = max_y - 1;
 	else
 		vc->vc_y = new_y;
-	vc->vc_pos = vc->vc_origin + vc->vc_y * vc->vc_size_row + (vc->vc_x << 1);
+	vc->vc_pos = (unsigned long) (vc_row(vc, vc->vc_y) + vc->vc_x);
 	vc->vc_need_wrap = 0;
 }
 
@@ -287,7 +291,7 @@ inline void gotoxay(struct vc_data *vc, int new_x, int new_y)
  */
 void set_palette(struct vc_data *vc)
 {
-	WARN_CONSOLE_UNLOCKED();
+	WARN_VT_UNLOCKED(vc->display_fg);
 	if (IS_VISIBLE && sw->con_set_palette && vc->vc_mode != KD_GRAPHICS)
 		sw->con_set_palette(vc, color_table);
 }
@@ -310,7 +314,7 @@ void reset_palette(struct vc_data *vc)
 static inline void scrolldelta(struct vt_struct *vt, int lines)
 {
 	vt->scrollback_delta += lines;
-	schedule_work(&vt->vt_work);
+	schedule_vt_work(vt);
 }
 
 void scroll_up(struct vc_data *vc, int lines)
@@ -327,18 +331,269 @@ void scroll_down(struct vc_data *vc, int lines)
 	scrolldelta(vc->display_fg, lines);
 }
 
+/*
+ * Is vc_origin pointing into our own screen buffer (as opposed to video
+ * memory handed out by the low-level driver's con_set_origin)?
+ */
+static inline int soft_origin(struct vc_data *vc)
+{
+	unsigned long base = (unsigned long) vc->vc_screenbuf;
+
+	return vc->vc_origin >= base &&
+	       vc->vc_origin < base + vc->vc_screenbuf_alloc;
+}
+
+/* All drawing of text goes through here, so it gets counted */
+static inline void vc_putcs(struct vc_data *vc, const u16 *s, int count,
+			    int y, int x)
+{
+	vc->vc_stats.putcs++;
+	vc->vc_stats.putcs_cells += count;
+	sw->con_putcs(vc, s, count, y, x);
+}
+
+/*
+ * Full screen scroll of the in-memory buffer. Instead of moving the
+ * whole screen for every line we slide vc_origin through the slack
+ * rows behind the screen, and only fold the screen back to the other
+ * end of the buffer when we run out of them.
+ */
+static void soft_scroll(struct vc_data *vc, int dir, int nr)
+{
+	unsigned long base = (unsigned long) vc->vc_screenbuf;
+	unsigned long end = base + vc->vc_screenbuf_alloc;
+	unsigned long oldo = vc->vc_origin;
+	unsigned int delta = nr * vc->vc_size_row;
+
+	if (dir == SM_UP) {
+		if (vc->vc_scr_end + delta > end) {
+			scr_memmovew((u16 *) base, (u16 *) (oldo + delta),
+				     vc->vc_screenbuf_size - delta);
+			vc->vc_origin = base;
+		} else
+			vc->vc_origin += delta;
+		scr_memsetw(vc_row(vc, vc->vc_rows - nr),
+			    vc->vc_video_erase_char, delta);
+	} else {
+		if (oldo - delta < base) {
+			scr_memmovew((u16 *) (end - vc->vc_screenbuf_size + delta),
+				     (u16 *) oldo, vc->vc_screenbuf_size - delta);
+			vc->vc_origin = end - vc->vc_screenbuf_size;
+		} else
+			vc->vc_origin -= delta;
+		scr_memsetw(vc_row(vc, 0), vc->vc_video_erase_char, delta);
+	}
+	vc->vc_scr_end = vc->vc_origin + vc->vc_screenbuf_size;
+	vc->vc_visible_origin = vc->vc_origin;
+	vc->vc_pos = (vc->vc_pos - oldo) + vc->vc_origin;
+}
+
+/*
+ * Fold a slid screen back to the start of vc_screenbuf, which is where
+ * the low-level drivers expect to find it.
+ */
+static void compact_screen(struct vc_data *vc)
+{
+	if (!soft_origin(vc) || vc->vc_origin == (unsigned long) vc->vc_screenbuf)
+		return;
+	scr_memmovew(vc->vc_screenbuf, (u16 *) vc->vc_origin,
+		     vc->vc_screenbuf_size);
+	vc->vc_origin = (unsigned long) vc->vc_screenbuf;
+}
+
+/*
+ * A VC that is not on screen only gets its buffer once something needs
+ * it, and loses it again under memory pressure while it is blank. With
+ * no buffer vc_origin is 0, so vc_pos and vc_scr_end are plain offsets
+ * into the screen that would be there.
+ */
+static kmem_cache_t *vc_cachep;
+static atomic_t vc_screens = ATOMIC_INIT(0);	/* kmalloced screen buffers */
+
+int vc_screen_need(struct vc_data *vc, unsigned int gfp_mask)
+{
+	unsigned int alloc = vc->vc_screenbuf_size * VC_SCREENBUF_PAGES;
+	unsigned short *p;
+
+	if (vc->vc_screenbuf)
+		return 0;
+	p = kmalloc(alloc, gfp_mask);
+	if (!p)
+		return -ENOMEM;
+	scr_memsetw(p, vc->vc_video_erase_char, vc->vc_screenbuf_size);
+	vc->vc_screenbuf = p;
+	vc->vc_screenbuf_alloc = alloc;
+	vc->vc_kmalloced = 1;
+	vc->vc_origin = (unsigned long) p;
+	vc->vc_visible_origin = vc->vc_origin;
+	vc->vc_scr_end = vc->vc_origin + vc->vc_screenbuf_size;
+	vc->vc_pos += vc->vc_origin;
+	atomic_inc(&vc_screens);
+	return 0;
+}
+
+static int vc_screen_drop(struct vc_data *vc)
+{
+	struct vt_struct *vt = vc->display_fg;
+	u16 *p;
+
+	if (!vc->vc_kmalloced || vc == vt->fg_console || vc == vt->want_vc ||
+	    vc == sel_cons || vc->vc_mode != KD_TEXT || vc->vc_shadow ||
+	    vc->vc_hist_view || !soft_origin(vc))
+		return 0;
+	for (p = (u16 *) vc->vc_origin; p < (u16 *) vc->vc_scr_end; p++)
+		if (scr_readw(p) != vc->vc_video_erase_char)
+			return 0;
+
+	vc->vc_pos -= vc->vc_origin;
+	vc->vc_origin = vc->vc_visible_origin = 0;
+	vc->vc_scr_end = vc->vc_screenbuf_size;
+	kfree(vc->vc_screenbuf);
+	vc->vc_screenbuf = NULL;
+	vc->vc_screenbuf_alloc = 0;
+	vc->vc_kmalloced = 0;
+	atomic_dec(&vc_screens);
+	return 1;
+}
+
+static void __release_vt_sem(struct vt_struct *vt);
+
+/*
+ * Called by the VM when it wants memory back. Everything here is only
+ * tried, never waited for: the allocation that got us here may well
+ * have been made with one of these locks held. Releasing console_sem
+ * may print, so callers that cannot sleep or recurse into the
+ * filesystem are left alone.
+ */
+static int vc_shrink(int nr_to_scan, unsigned int gfp_mask)
+{
+	struct vt_struct *vt;
+	int i;
+
+	if (!nr_to_scan)
+		return atomic_read(&vc_screens);
+	if ((gfp_mask & (__GFP_WAIT | __GFP_FS)) != (__GFP_WAIT | __GFP_FS))
+		return -1;
+	if (try_acquire_console_sem())
+		return -1;
+	list_for_each_entry(vt, &vt_list, node) {
+		if (try_acquire_vt_sem(vt))
+			continue;
+		for (i = 0; i < vt->vc_count && nr_to_scan > 0; i++) {
+			if (!vt->vc_cons[i])
+				continue;
+			vc_screen_drop(vt->vc_cons[i]);
+			nr_to_scan--;
+		}
+		__release_vt_sem(vt);	/* release_console_sem() flushes */
+	}
+	release_console_sem();
+	return atomic_read(&vc_screens);
+}
+
+/*
+ * Software scrollback. The history rows are drawn over the display
+ * while the live screen stays put; if the live screen sits in video
+ * memory it is parked in vc_screenbuf (which is stale in that case)
+ * and put back as soon as anything touches the screen again.
+ */
+static void draw_row(struct vc_data *vc, const u16 *p, int y)
+{
+	int x, startx = 0;
+
+	for (x = 1; x <= vc->vc_cols; x++) {
+		if (x < vc->vc_cols &&
+		    (scr_readw(p + x) & 0xff00) == (scr_readw(p + startx) & 0xff00))
+			continue;
+		vc_putcs(vc, p + startx, x - startx, y, startx);
+		startx = x;
+	}
+}
+
+/*
+ * Back to the live screen. Anything that reads or changes the screen
+ * contents must call this first, or it would act on history rows.
+ */
+void history_unview(struct vc_data *vc)
+{
+	if (!vc->vc_hist_view)
+		return;
+	vc->vc_hist_view = 0;
+	if (!soft_origin(vc))
+		scr_memcpyw(vc_row(vc, 0), vc->vc_screenbuf, vc->vc_screenbuf_size);
+	else if (IS_VISIBLE)
+		do_update_region(vc, vc->vc_origin, vc->vc_screenbuf_size/2);
+	vcs_changed(vc);
+}
+
+static void history_scroll(struct vc_data *vc, int lines)
+{
+	unsigned int view = 0, nr, y;
+	u16 *buf;
+
+	if (lines) {
+		int v = (int) vc->vc_hist_view - lines;
+
+		if (v > 0)
+			view = min_t(unsigned int, v, vc->vc_hist_lines);
+	}
+	if (view == vc->vc_hist_view)
+		return;
+
+	hide_cursor(vc);
+	if (!view)
+		return;
+	nr = min(view, vc->vc_rows);
+
+	if (!soft_origin(vc)) {
+		/* Park the live screen and draw straight into video memory */
+		scr_memcpyw(vc->vc_screenbuf, vc_row(vc, 0), vc->vc_screenbuf_size);
+		vc_history_read(vc, view, vc_row(vc, 0), nr);
+		if (nr < vc->vc_rows)
+			scr_memcpyw(vc_row(vc, nr), vc->vc_screenbuf,
+				    (vc->vc_rows - nr) * vc->vc_size_row);
+		vc->vc_hist_view = view;
+		do_update_region(vc, vc->vc_origin, vc->vc_screenbuf_size/2);
+		vcs_changed(vc);
+		return;
+	}
+
+	buf = kmalloc(nr * vc->vc_size_row, GFP_KERNEL);
+	if (!buf)
+		return;
+	vc_history_read(vc, view, buf, nr);
+	vc->vc_hist_view = view;
+	for (y = 0; y < vc->vc_rows; y++)
+		draw_row(vc, y < nr ? buf + y * vc->vc_cols : vc_row(vc, y - nr), y);
+	kfree(buf);
+	vcs_changed(vc);
+}
+
 void scroll_region_up(struct vc_data *vc, unsigned int t, unsigned int b, int nr)
 {
 	unsigned short *d, *s;
+	int i;
 
 	if (t+nr >= b)
 		nr = b - t - 1;
 	if (b > vc->vc_rows || t >= b || nr < 1)
 		return;
-	if (IS_VISIBLE && sw->con_scroll_region(vc, t, b, SM_UP, nr))
+	/* Only rows leaving the whole screen go to the history */
+	if (!t && b == vc->vc_rows)
+		for (i = 0; i < nr; i++)
+			vc_history_push(vc, vc_row(vc, i));
+	if (IS_VISIBLE && sw->con_scroll_region(vc, t, b, SM_UP, nr)) {
+		vc->vc_stats.scroll_hw++;
 		return;
-	d = (unsigned short *) (vc->vc_origin + vc->vc_size_row*t);
-	s = (unsigned short *) (vc->vc_origin + vc->vc_size_row*(t+nr));
+	}
+	if (!t && b == vc->vc_rows && soft_origin(vc)) {
+		vc->vc_stats.scroll_soft++;
+		soft_scroll(vc, SM_UP, nr);
+		return;
+	}
+	vc->vc_stats.scroll_copy++;
+	d = vc_row(vc, t);
+	s = vc_row(vc, t + nr);
 	scr_memmovew(d, s, (b-t-nr) * vc->vc_size_row);
 	scr_memsetw(d + (b-t-nr) * vc->vc_cols, vc->vc_video_erase_char, vc->vc_size_row*nr);
 }
@@ -352,9 +607,17 @@ void scroll_region_down(struct vc_data *vc, unsigned int t, unsigned int b, int
 		nr = b - t - 1;
 	if (b > vc->vc_rows || t >= b || nr < 1)
 		return;
-	if (IS_VISIBLE && sw->con_scroll_region(vc, t, b, SM_DOWN, nr))
+	if (IS_VISIBLE && sw->con_scroll_region(vc, t, b, SM_DOWN, nr)) {
+		vc->vc_stats.scroll_hw++;
 		return;
-	s = (unsigned short *) (vc->vc_origin + vc->vc_size_row*t);
+	}
+	if (!t && b == vc->vc_rows && soft_origin(vc)) {
+		vc->vc_stats.scroll_soft++;
+		soft_scroll(vc, SM_DOWN, nr);
+		return;
+	}
+	vc->vc_stats.scroll_copy++;
+	s = vc_row(vc, t);
 	step = vc->vc_cols * nr;
 	scr_memmovew(s + step, s, (b-t-nr)*vc->vc_size_row);
 	scr_memsetw(s, vc->vc_video_erase_char, 2*step);
@@ -497,13 +760,14 @@ void delete_line(struct vc_data *vc, unsigned int nr)
  */
 void set_origin(struct vc_data *vc)
 {
-	WARN_CONSOLE_UNLOCKED();
+	WARN_VT_UNLOCKED(vc->display_fg);
 
+	compact_screen(vc);
 	if (!IS_VISIBLE || !sw->con_set_origin || !sw->con_set_origin(vc))
 		vc->vc_origin = (unsigned long) vc->vc_screenbuf;
 	vc->vc_visible_origin = vc->vc_origin;
 	vc->vc_scr_end = vc->vc_origin + vc->vc_screenbuf_size;
-	vc->vc_pos = vc->vc_origin + vc->vc_size_row * vc->vc_y + 2 * vc->vc_x;
+	vc->vc_pos = (unsigned long) (vc_row(vc, vc->vc_y) + vc->vc_x);
 }
 
 inline void clear_region(struct vc_data *vc, int sx, int sy, int width, int height)
@@ -515,7 +779,7 @@ inline void clear_region(struct vc_data *vc, int sx, int sy, int width, int heig
 
 inline void save_screen(struct vc_data *vc)
 {
-	WARN_CONSOLE_UNLOCKED();
+	WARN_VT_UNLOCKED(vc->display_fg);
 
 	if (sw->con_save_screen)
 		sw->con_save_screen(vc);
@@ -544,7 +808,7 @@ void do_update_region(struct vc_data *vc, unsigned long start, int count)
 		while (xx < vc->vc_cols && count) {
 			if (attrib != (scr_readw(p) & 0xff00)) {
 				if (p > q)
-					sw->con_putcs(vc, q, p-q, yy, startx);
+					vc_putcs(vc, q, p-q, yy, startx);
 				startx = xx;
 				q = p;
 				attrib = scr_readw(p) & 0xff00;
@@ -554,7 +818,7 @@ void do_update_region(struct vc_data *vc, unsigned long start, int count)
 			count--;
 		}
 		if (p > q)
-			sw->con_putcs(vc, q, p-q, yy, startx);
+			vc_putcs(vc, q, p-q, yy, startx);
 		if (!count)
 			break;
 		xx = 0;
@@ -569,7 +833,7 @@ void do_update_region(struct vc_data *vc, unsigned long start, int count)
 
 void update_region(struct vc_data *vc, unsigned long start, int count)
 {
-	WARN_CONSOLE_UNLOCKED();
+	WARN_VT_UNLOCKED(vc->display_fg);
 
 	if (DO_UPDATE) {
 		hide_cursor(vc);
@@ -623,7 +887,7 @@ void invert_screen(struct vc_data *vc, int offset, int count, int viewed)
 {
 	unsigned short *p;
 
-	WARN_CONSOLE_UNLOCKED();
+	WARN_VT_UNLOCKED(vc->display_fg);
 
 	count /= 2;
 	p = screenpos(vc, offset, viewed);
@@ -679,7 +943,8 @@ void complement_pos(struct vc_data *vc, int offset)
 	static unsigned short oldx, oldy, old;
 	static unsigned short *p;
 
-	WARN_CONSOLE_UNLOCKED();
+	if (vc)
+		WARN_VT_UNLOCKED(vc->display_fg);
 
 	if (p) {
 		scr_writew(old, p);
@@ -733,7 +998,7 @@ void do_blank_screen(struct vt_struct *vt, int entering_gfx)
 	struct vc_data *vc = vt->fg_console;
 	int i;
 
-	WARN_CONSOLE_UNLOCKED();
+	WARN_VT_UNLOCKED(vt);
 
 	if (vt->vt_blanked) {
 		if (vt->blank_state == blank_vesa_wait) {
@@ -772,6 +1037,8 @@ void do_blank_screen(struct vt_struct *vt, int entering_gfx)
 	vt->vt_blanked = 1;
 	if (i)
 		set_origin(vc);
+	vcs_changed(vc);
+	vt_event_post(VT_EVENT_BLANK, vt, vc->vc_num, vc->vc_num);
 
 	if (console_blank_hook && console_blank_hook(1))
 		return;
@@ -798,7 +1065,7 @@ static void blank_screen_t(unsigned long dummy)
 		return;
 	}
 	vt->blank_timer_expired = 1;
-	schedule_work(&vt->vt_work);
+	schedule_vt_work(vt);
 }
 
 /*
@@ -832,18 +1099,27 @@ void unblank_vt(struct vt_struct *vt)
 		console_blank_hook(0);
 	set_palette(vc);
 	set_cursor(vc);
+	vcs_changed(vc);
+	vt_event_post(VT_EVENT_UNBLANK, vt, vc->vc_num, vc->vc_num);
 }
 EXPORT_SYMBOL(unblank_vt);
 
 /*
- * Called by vt_console_driver
+ * Called by vt_console_driver. A display whose lock is held is left
+ * to its holder, who will poke it anyway, unless we are oopsing.
  */
 void unblank_screen(void)
 {
         struct vt_struct *vt;
 
         list_for_each_entry (vt, &vt_list, node) {
+		if (try_acquire_vt_sem(vt)) {
+			if (oops_in_progress)
+				unblank_vt(vt);
+			continue;
+		}
                 unblank_vt(vt);
+		release_vt_sem(vt);
         }
 }
 
@@ -851,7 +1127,7 @@ void poke_blanked_console(struct vt_struct *vt)
 {
 	struct vc_data *vc = vt->fg_console;
 
-	WARN_CONSOLE_UNLOCKED();
+	WARN_VT_UNLOCKED(vt);
 
 	del_timer(&vt->timer);
 	vt->blank_timer_expired = 0;
@@ -872,7 +1148,8 @@ void poke_blanked_console(struct vt_struct *vt)
  * us to do the switches asynchronously (needed when we want
  * to switch due to a keyboard interrupt).  Synchronization
  * with other console code and prevention of re-entrancy is
- * ensured with the console semaphore.
+ * ensured with the display's vt_sem; each display runs this
+ * from its own workqueue, so a busy display can't hold up another.
  */
 static void vt_callback(void *private)
 {
@@ -881,37 +1158,59 @@ static void vt_callback(void *private)
 	if (!vt || !vt->want_vc || !vt->want_vc->vc_tty)
 		return;
 
-	acquire_console_sem();
+	acquire_vt_sem(vt);
 
 	if ((vt->want_vc != vt->fg_console) && !vt->vt_dont_switch) {
 		hide_cursor(vt->fg_console);
-		change_console(vt->want_vc, vt->fg_console);
+		/*
+		 * Give the new VC its screen before anything is committed
+		 * to the switch; without one the switch is refused.
+		 */
+		if (vc_screen_need(vt->want_vc, GFP_KERNEL)) {
+			printk(KERN_WARNING "vt: no memory to switch to tty%d\n",
+			       vt->want_vc->vc_num + 1);
+			vt->want_vc = vt->fg_console;
+		} else
+			change_console(vt->want_vc, vt->fg_console);
 		/* we only changed when the console had already
 		   been allocated - a new console is not created
 		   in an interrupt routine */
 	}
-	if (do_poke_blanked_console) { /* do not unblank for a LED change */
-		do_poke_blanked_console = 0;
+	if (vt->poke_blanked) { /* do not unblank for a LED change */
+		vt->poke_blanked = 0;
 		poke_blanked_console(vt);
 	}
 	if (vt->scrollback_delta) {
 		struct vc_data *vc = vt->fg_console;
-		clear_selection();
-		if (vc->vc_mode == KD_TEXT)
-			sw->con_scroll(vc, vt->scrollback_delta);
+		clear_selection_on(vt);
+		if (vc->vc_mode == KD_TEXT) {
+			/* Fall back to the hardware when we keep no history */
+			if (vc->vc_hist_lines || vc->vc_hist_view)
+				history_scroll(vc, vt->scrollback_delta);
+			else
+				sw->con_scroll(vc, vt->scrollback_delta);
+		}
 		vt->scrollback_delta = 0;
 	}
 	if (vt->blank_timer_expired) {
 		do_blank_screen(vt, 0);
 		vt->blank_timer_expired = 0;
 	}
-	release_console_sem();
+	release_vt_sem(vt);
+}
+
+void schedule_vt_work(struct vt_struct *vt)
+{
+	if (vt->vt_wq)
+		queue_work(vt->vt_wq, &vt->vt_work);
+	else
+		schedule_work(&vt->vt_work);
 }
 
 inline void set_console(struct vc_data *vc)
 {
 	vc->display_fg->want_vc = vc;
-	schedule_work(&vc->display_fg->vt_work);
+	schedule_vt_work(vc->display_fg);
 }
 
 /*
@@ -944,6 +1243,8 @@ static void vc_init(struct vc_data *vc, int do_clear)
 	vc->vc_ulcolor = 0x0f;		/* bold white */
 	vc->vc_halfcolor = 0x08;	/* grey */
 	init_waitqueue_head(&vc->paste_wait);
+	INIT_LIST_HEAD(&vc->vc_hist);
+	init_waitqueue_head(&vc->vc_vcs_wait);
 	vte_ris(vc, do_clear);
 }
 
@@ -985,14 +1286,9 @@ struct vc_data *vc_allocate(unsigned int currcons)
 	currcons = -ENXIO;
 	return NULL;
 found_pool:
-	/* due to the granularity of kmalloc, we waste some memory here */
-	/* the alloc is done in two steps, to optimize the common situation
-	   of a 25x80 console (structsize=216, screenbuf_size=4000) */
-	/* although the numbers above are not valid since long ago, the
-	   point is still up-to-date and the comment still has its value
-	   even if only as a historical artifact.  --mj, July 1998 */
-	if (vt->kmalloced || !((vt->first_vc)== currcons))
-		vc = (struct vc_data *) kmalloc(sizeof(struct vc_data), GFP_KERNEL);
+	/* Before the slab is up only the boot display's first VC exists */
+	if (vc_cachep)
+		vc = kmem_cache_alloc(vc_cachep, GFP_KERNEL);
 	else
 		vc = (struct vc_data *) alloc_bootmem(sizeof(struct vc_data));
 	if (!vc) {
@@ -1003,11 +1299,12 @@ found_pool:
 		
 	vc->vc_num = currcons;
 	vc->display_fg = vt;
+	vc->vc_slab = vc_cachep != NULL;
 	visual_init(vc, 1);
-	if (vt->kmalloced || !((vt->first_vc) == currcons)) {
-		vc->vc_screenbuf = (unsigned short *) kmalloc(vc->vc_screenbuf_size, GFP_KERNEL);
-		if (!vc->vc_screenbuf) {
-			kfree(vc);
+	if (vc->vc_slab) {
+		/* Only the VC going on screen needs its buffer right away */
+		if (vt->first_vc == currcons && vc_screen_need(vc, GFP_KERNEL)) {
+			kmem_cache_free(vc_cachep, vc);
 			currcons = -ENOMEM;
 			return NULL;
 		}
@@ -1015,17 +1312,21 @@ found_pool:
 		if (!*vc->vc_uni_pagedir_loc)
 			con_set_default_unimap(vc);
 	} else {
-		vc->vc_screenbuf = (unsigned short *) alloc_bootmem(vc->vc_screenbuf_size);
+		vc->vc_screenbuf_alloc = vc->vc_screenbuf_size * VC_SCREENBUF_PAGES;
+		vc->vc_screenbuf = (unsigned short *) alloc_bootmem(vc->vc_screenbuf_alloc);
 		if (!vc->vc_screenbuf) {
 			free_bootmem((unsigned long) vc, sizeof(struct vc_data));
 			currcons = -ENOMEM;
 			return NULL;
 		}
 	}
+	acquire_vt_sem(vt);
 	vt->vc_cons[currcons - vt->first_vc] = vc;
 	if ((vt->first_vc) == currcons)
 		vt->want_vc = vt->fg_console = vt->last_console = vc;
-	vc_init(vc, 1);
+	/* A VC without a buffer is blank already */
+	vc_init(vc, vc->vc_screenbuf != NULL);
+	release_vt_sem(vt);
 	return vc;
 }
 
@@ -1036,11 +1337,22 @@ int vc_disallocate(struct vc_data *vc)
 	WARN_CONSOLE_UNLOCKED();
 
 	if (vc && vc->vc_num > MIN_NR_CONSOLES) {
+		acquire_vt_sem(vt);
 		sw->con_deinit(vc);
+		vc_history_free(vc);
+		vcs_detach(vc);
 		vt->vc_cons[vc->vc_num - vt->first_vc] = NULL;
-		if (vt->kmalloced)
-			kfree(screenbuf);
-		kfree(vc);
+		/* Keep its counters in the display's totals */
+		vc_stats_add(&vt->vt_stats, &vc->vc_stats);
+		release_vt_sem(vt);
+		/* VT_WAITACTIVE on it would never be woken otherwise */
+		vt_waitactive_wake(vc->vc_num);
+		if (vc->vc_kmalloced) {
+			kfree(vc->vc_screenbuf);
+			atomic_dec(&vc_screens);
+		}
+		if (vc->vc_slab)
+			kmem_cache_free(vc_cachep, vc);
 	}
 	return 0;
 }
@@ -1076,11 +1388,11 @@ int vc_resize(struct vc_data *vc, unsigned int cols, unsigned int lines)
 	unsigned int new_cols, new_rows, ss, new_row_size, err = 0;
 	unsigned short *newscreen;
 
-	WARN_CONSOLE_UNLOCKED();
-
 	if (!vc)
 		return 0;
 
+	WARN_VT_UNLOCKED(vc->display_fg);
+
 	if (cols > VC_RESIZE_MAXCOL || lines > VC_RESIZE_MAXROW)
 		return -EINVAL;
 
@@ -1092,9 +1404,16 @@ int vc_resize(struct vc_data *vc, unsigned int cols, unsigned int lines)
 	if (new_cols == vc->vc_cols && new_rows == vc->vc_rows)
 		return 0;
 
-	newscreen = (unsigned short *) kmalloc(ss, GFP_USER);
-	if (!newscreen) 
-		return -ENOMEM;
+	/* The new screen is copied from vc_origin, so it must be live */
+	history_unview(vc);
+
+	/* A VC without a buffer gets one of the new size when it needs it */
+	newscreen = NULL;
+	if (vc->vc_screenbuf) {
+		newscreen = (unsigned short *) kmalloc(ss * VC_SCREENBUF_PAGES, GFP_USER);
+		if (!newscreen) 
+			return -ENOMEM;
+	}
 
 	old_rows = vc->vc_rows;
 	old_cols = vc->vc_cols;
@@ -1113,30 +1432,34 @@ int vc_resize(struct vc_data *vc, unsigned int cols, unsigned int lines)
 	vc->vc_size_row = new_row_size;
 	vc->vc_screenbuf_size = ss;
 
-	rlth = min(old_row_size, new_row_size);
-	rrem = new_row_size - rlth;
-	ol = vc->vc_origin;
-	nl = (long) newscreen;
-	nlend = nl + ss;
-	if (new_rows < old_rows)
-		ol += (old_rows - new_rows) * old_row_size;
-
 	update_attr(vc);
 
-	while (ol < vc->vc_scr_end) {
-		scr_memcpyw((unsigned short *) nl, (unsigned short *) ol, rlth);
-		if (rrem)
-			scr_memsetw((void *)(nl + rlth), vc->vc_video_erase_char, rrem);
-		ol += old_row_size;
-		nl += new_row_size;
-	}
-	if (nlend > nl)
-		scr_memsetw((void *) nl, vc->vc_video_erase_char, nlend - nl);
-	if (vc->display_fg->kmalloced)
-		kfree(vc->vc_screenbuf);
-	vc->vc_screenbuf = newscreen;
-	vc->display_fg->kmalloced = 1;
-	vc->vc_screenbuf_size = ss;
+	if (newscreen) {
+		rlth = min(old_row_size, new_row_size);
+		rrem = new_row_size - rlth;
+		ol = vc->vc_origin;
+		nl = (long) newscreen;
+		nlend = nl + ss;
+		if (new_rows < old_rows)
+			ol += (old_rows - new_rows) * old_row_size;
+
+		while (ol < vc->vc_scr_end) {
+			scr_memcpyw((unsigned short *) nl, (unsigned short *) ol, rlth);
+			if (rrem)
+				scr_memsetw((void *)(nl + rlth), vc->vc_video_erase_char, rrem);
+			ol += old_row_size;
+			nl += new_row_size;
+		}
+		if (nlend > nl)
+			scr_memsetw((void *) nl, vc->vc_video_erase_char, nlend - nl);
+		if (vc->vc_kmalloced)
+			kfree(vc->vc_screenbuf);
+		else
+			atomic_inc(&vc_screens);
+		vc->vc_screenbuf = newscreen;
+		vc->vc_kmalloced = 1;
+		vc->vc_screenbuf_alloc = ss * VC_SCREENBUF_PAGES;
+	}
 	set_origin(vc);
 
 	/* do part of a reset_terminal() */
@@ -1160,6 +1483,8 @@ int vc_resize(struct vc_data *vc, unsigned int cols, unsigned int lines)
 
 	if (IS_VISIBLE)
 		update_screen(vc);
+	vcs_changed(vc);
+	vt_event_post(VT_EVENT_RESIZE, vc->display_fg, vc->vc_num, vc->vc_num);
 	return 0;
 }
 
@@ -1192,20 +1517,59 @@ int mouse_reporting(struct vc_data *vc)
  * kernel memory allocation is available.
  */
 
+/*
+ * Look up the tty's VC and take its display's vt_sem. The display is
+ * found under the console semaphore, but we must not sleep on vt_sem
+ * with it held: a writer waiting on a busy display would then stall
+ * every other one. vt_close() clears tty->driver_data under vt_sem,
+ * and an open tty's VC is never disallocated, so seeing the same VC
+ * once we have vt_sem means it is still ours. Returns NULL, unlocked,
+ * if the tty has no VC.
+ */
+static struct vc_data *vt_lock_tty(struct tty_struct *tty)
+{
+	struct vc_data *vc;
+	struct vt_struct *vt = NULL;
+
+	acquire_console_sem();
+	vc = tty->driver_data;
+	if (vc)
+		vt = vc->display_fg;
+	release_console_sem();
+	if (!vt)
+		return NULL;
+
+	acquire_vt_sem(vt);
+	if (tty->driver_data != vc) {
+		release_vt_sem(vt);
+		return NULL;
+	}
+	return vc;
+}
+
+/*
+ * We don't buffer, so the VT reports plenty of room, but one
+ * do_con_write() draws at most VT_WRITE_BATCH characters under the
+ * display's vt_sem. The ldisc comes back for the rest, so a large
+ * write doesn't keep the display's other users waiting.
+ */
+#define VT_WRITE_ROOM	65536
+#define VT_WRITE_BATCH	4096
+
 static int do_con_write(struct tty_struct *tty, const unsigned char *buf, int count)
 {
 #ifdef VT_BUF_VRAM_ONLY
 #define FLUSH do { } while(0);
 #else
 #define FLUSH if (draw_x >= 0 && sw->con_putcs) { \
-	sw->con_putcs(vc, (u16 *)draw_from, (u16 *)draw_to-(u16 *)draw_from, vc->vc_y, draw_x); \
+	vc_putcs(vc, (u16 *)draw_from, (u16 *)draw_to-(u16 *)draw_from, vc->vc_y, draw_x); \
 	draw_x = -1; \
 	}
 #endif
 	unsigned long draw_from = 0, draw_to = 0;
-	struct vc_data *vc = tty->driver_data;
+	struct vc_data *vc;
 	const unsigned char *orig_buf = NULL;
-	int c, tc, ok, n = 0, draw_x = -1;
+	int c, tc, ok, n = 0, glyphs = 0, draw_x = -1;
 	u16 himask, charmask;
 	int orig_count;
 
@@ -1214,26 +1578,28 @@ static int do_con_write(struct tty_struct *tty, const unsigned char *buf, int co
 
 	might_sleep();
 
-	acquire_console_sem();
+	if (count > VT_WRITE_BATCH)
+		count = VT_WRITE_BATCH;
+
+	/* At this point 'buf' is guaranteed to be a kernel buffer
+	 * and therefore no access to userspace (and therefore sleeping)
+	 * will be needed.  We hold the display's vt_sem during the
+	 * entire write; other displays carry on meanwhile.
+	 */
 
+	vc = vt_lock_tty(tty);
 	if (!vc) {
 		printk("vt_write: tty %d not allocated\n", tty->index);
-		release_console_sem();
 		return 0;
 	}
-	release_console_sem();
 	
 	orig_buf = buf;
 	orig_count = count;
 
-	/* At this point 'buf' is guaranteed to be a kernel buffer
-	 * and therefore no access to userspace (and therefore sleeping)
-	 * will be needed.  The VT buffer lock serializes all tty based
-	 * console rendering and vcs write/read operations.  We hold
-	 * the console spinlock during the entire write.
-	 */
-
-	acquire_console_sem();
+	if (vc_screen_need(vc, GFP_KERNEL)) {
+		release_vt_sem(vc->display_fg);
+		return -ENOMEM;
+	}
 
 	himask = vc->vc_hi_font_mask;
 	charmask = himask ? 0x1ff : 0xff;
@@ -1335,6 +1701,7 @@ static int do_con_write(struct tty_struct *tty, const unsigned char *buf, int co
 				insert_char(vc, 1);
 			scr_writew(himask ?
 				     ((vc->vc_attr << 8) & ~himask) + ((tc & 0x100) ? himask : 0) + (tc & 0xff) : (vc->vc_attr << 8) + tc, (u16 *) vc->vc_pos);
+			glyphs++;
 			if (DO_UPDATE && draw_x < 0) {
 				draw_x = vc->vc_x;
 				draw_from = vc->vc_pos;
@@ -1352,8 +1719,11 @@ static int do_con_write(struct tty_struct *tty, const unsigned char *buf, int co
 		terminal_emulation(tty, c);
 	}
 	FLUSH
-	console_conditional_schedule();
-	release_console_sem();
+	vc->vc_stats.bytes += n;
+	vc->vc_stats.glyphs += glyphs;
+	vcs_changed(vc);
+	release_vt_sem(vc->display_fg);
+	cond_resched();
 	return n;
 #undef FLUSH
 }
@@ -1400,9 +1770,13 @@ static void vt_close(struct tty_struct *tty, struct file * filp)
 	acquire_console_sem();
 	if (tty && tty->count == 1) {
 		struct vc_data *vc = tty->driver_data;
-		if (vc)
+		if (vc) {
+			acquire_vt_sem(vc->display_fg);
 			vc->vc_tty = NULL;
-		tty->driver_data = NULL;
+			tty->driver_data = NULL;
+			release_vt_sem(vc->display_fg);
+		} else
+			tty->driver_data = NULL;
 		release_console_sem();
 		vcs_remove_devfs(tty);
 		up(&tty_sem);
@@ -1436,7 +1810,7 @@ static int vt_write_room(struct tty_struct *tty)
 {
 	if (tty->stopped)
 		return 0;
-	return 4096;		/* No limit, really; we're not buffering */
+	return VT_WRITE_ROOM;	/* No limit, really; we're not buffering */
 }
 
 static void vt_flush_chars(struct tty_struct *tty)
@@ -1447,11 +1821,11 @@ static void vt_flush_chars(struct tty_struct *tty)
 		return;
 
 	/* if we race with vt_close(), vc may be null */
-	acquire_console_sem();
-	vc = tty->driver_data;
-	if (vc)
-		set_cursor(vc);
-	release_console_sem();
+	vc = vt_lock_tty(tty);
+	if (!vc)
+		return;
+	set_cursor(vc);
+	release_vt_sem(vc->display_fg);
 }
 
 static int vt_chars_in_buffer(struct tty_struct *tty)
@@ -1509,6 +1883,34 @@ static void vt_unthrottle(struct tty_struct *tty)
 	wake_up_interruptible(&vc->paste_wait);
 }
 
+/*
+ * Called with vt_sem still held, just before letting go of it. The
+ * holder may have slept and moved to a CPU whose sched_clock() is
+ * behind the one it started on, so a hold that comes out negative
+ * counts as zero rather than wrapping.
+ */
+static inline void vt_sem_account(struct vt_struct *vt)
+{
+	unsigned long long now = sched_clock(), held = 0;
+
+	if (now > vt->vt_lock_since)
+		held = now - vt->vt_lock_since;
+
+	vt->vt_lock_ns += held;
+	if (held > vt->vt_lock_max)
+		vt->vt_lock_max = held;
+	smp_wmb();		/* vt_show_stats() reads the count first */
+	vt->vt_lock_count++;
+}
+
+/* Lets go of vt_sem without flushing any kernel messages it held back */
+static void __release_vt_sem(struct vt_struct *vt)
+{
+	vt_sem_account(vt);
+	vt->vt_owner = NULL;
+	up(&vt->vt_sem);
+}
+
 #ifdef CONFIG_VT_CONSOLE
 
 /*
@@ -1517,32 +1919,35 @@ static void vt_unthrottle(struct tty_struct *tty)
  * The console must be locked when we get here.
  */
 
-void vt_console_print(struct console *co, const char *b, unsigned count)
+/*
+ * printk only appends to a per-CPU ring; whoever gets the printing bit
+ * drains every ring and renders it. Other callers never wait for the
+ * console and nothing is lost unless a ring overflows, in which case
+ * the drop is counted and reported on the console.
+ */
+#define VT_KMSG_RING	4096		/* Bytes per CPU, power of two */
+
+struct vt_kmsg_ring {
+	unsigned int head;		/* Written by the owning CPU only */
+	unsigned int tail;		/* Written by the drainer only */
+	unsigned long dropped;		/* Bytes that did not fit */
+	unsigned long discarded;	/* Bytes the drainer could not show */
+	unsigned long reported;		/* Drops already reported */
+	char buf[VT_KMSG_RING];
+};
+
+static DEFINE_PER_CPU(struct vt_kmsg_ring, vt_kmsg_ring);
+static unsigned long printing;
+
+static void vt_console_render(struct vc_data *vc, const char *b, unsigned count)
 {
-	struct vc_data *vc = find_vc(kmsg_redirect);
-	static unsigned long printing;
 	const ushort *start;
 	ushort myx, cnt = 0;
 	unsigned char c;
 
-	/* console busy or not yet initialized */
-	if (!printable || test_and_set_bit(0, &printing))
-		return;
-
-	if (!vc)
-		vc = admin_vt->fg_console;
-
 	/* read `x' only after setting currcons properly (otherwise
 	   the `x' macro will read the x of the foreground console). */
 	myx = vc->vc_x;
-
-	if (vc->vc_mode != KD_TEXT)
-		goto quit;
-
-	/* undraw cursor first */
-	if (IS_VISIBLE)
-		hide_cursor(vc);
-
 	start = (ushort *)vc->vc_pos;
 
 	/* Contrived structure to try to emulate original need_wrap behaviour
@@ -1552,7 +1957,7 @@ void vt_console_print(struct console *co, const char *b, unsigned count)
 		if (c == 10 || c == 13 || c == 8 || vc->vc_need_wrap) {
 			if (cnt > 0) {
 				if (IS_VISIBLE)
-					sw->con_putcs(vc, start, cnt, vc->vc_y, vc->vc_x);
+					vc_putcs(vc, start, cnt, vc->vc_y, vc->vc_x);
 				vc->vc_x += cnt;
 				if (vc->vc_need_wrap)
 					vc->vc_x--;
@@ -1583,19 +1988,180 @@ void vt_console_print(struct console *co, const char *b, unsigned count)
 	}
 	if (cnt > 0) {
 		if (IS_VISIBLE)
-			sw->con_putcs(vc, start, cnt, vc->vc_y, vc->vc_x);
+			vc_putcs(vc, start, cnt, vc->vc_y, vc->vc_x);
 		vc->vc_x += cnt;
 		if (vc->vc_x == vc->vc_cols) {
 			vc->vc_x--;
 			vc->vc_need_wrap = 1;
 		}
 	}
+}
+
+/* Render everything queued on @ring, in at most two contiguous pieces */
+static int vt_console_drain(struct vc_data *vc, struct vt_kmsg_ring *ring)
+{
+	unsigned int head = ring->head, tail = ring->tail, len;
+	unsigned long dropped = ring->dropped + ring->discarded;
+
+	if (head == tail && dropped == ring->reported)
+		return 0;
+	smp_rmb();
+	while (tail != head) {
+		unsigned int off = tail & (VT_KMSG_RING - 1);
+
+		len = min(head - tail, VT_KMSG_RING - off);
+		vt_console_render(vc, ring->buf + off, len);
+		tail += len;
+	}
+	smp_mb();
+	ring->tail = tail;
+
+	if (dropped != ring->reported) {
+		char msg[64];
+
+		len = sprintf(msg, "\n[vt: %lu bytes of console output dropped]\n",
+			      dropped - ring->reported);
+		vt_console_render(vc, msg, len);
+		ring->reported = dropped;
+	}
+	return 1;
+}
+
+static void vt_console_queue(const char *b, unsigned count)
+{
+	struct vt_kmsg_ring *ring;
+	unsigned long flags;
+	unsigned int head, room, off, len;
+
+	local_irq_save(flags);
+	ring = &__get_cpu_var(vt_kmsg_ring);
+	head = ring->head;
+	room = VT_KMSG_RING - (head - ring->tail);
+	if (count > room) {
+		ring->dropped += count - room;
+		count = room;
+	}
+	while (count) {
+		off = head & (VT_KMSG_RING - 1);
+		len = min(count, VT_KMSG_RING - off);
+		memcpy(ring->buf + off, b, len);
+		b += len;
+		head += len;
+		count -= len;
+	}
+	smp_wmb();
+	ring->head = head;
+	local_irq_restore(flags);
+}
+
+/*
+ * All of these walk the possible CPUs, not just the online ones: a CPU
+ * that goes down may leave messages in its ring.
+ */
+static int vt_console_pending(void)
+{
+	struct vt_kmsg_ring *ring;
+	int cpu;
+
+	for_each_cpu(cpu) {
+		ring = &per_cpu(vt_kmsg_ring, cpu);
+		if (ring->head != ring->tail ||
+		    ring->dropped + ring->discarded != ring->reported)
+			return 1;
+	}
+	return 0;
+}
+
+/* The VC printk draws on */
+static struct vc_data *vt_kmsg_vc(void)
+{
+	struct vc_data *vc = find_vc(kmsg_redirect);
+
+	return vc ? vc : admin_vt->fg_console;
+}
+
+/*
+ * Render the rings onto the kmsg console. That takes its display's
+ * vt_sem; if somebody holds it, release_vt_sem() calls back here once
+ * they are done, so printk never waits on a display.
+ */
+static void vt_console_flush(void)
+{
+	struct vc_data *vc;
+	struct vt_struct *vt;
+	int cpu, drawn, locked, discarding = 0;
+
+	/* Somebody else is draining; they will pick our message up */
+again:
+	if (test_and_set_bit(0, &printing))
+		return;
+
+	vc = vt_kmsg_vc();
+	vt = vc->display_fg;
+
+	locked = !try_acquire_vt_sem(vt);
+	if (!locked && !oops_in_progress) {
+		clear_bit(0, &printing);
+		smp_mb__after_clear_bit();
+		/* The holder may have let go before seeing our bit */
+		if (!vt->vt_owner && vt_console_pending())
+			goto again;
+		return;
+	}
+
+	if (vc->vc_mode != KD_TEXT || vc_screen_need(vc, GFP_ATOMIC)) {
+		/*
+		 * Nobody would see it; empty the rings, but count what
+		 * we throw away so the next drain that shows anything
+		 * reports it.
+		 */
+		for_each_cpu(cpu) {
+			struct vt_kmsg_ring *ring = &per_cpu(vt_kmsg_ring, cpu);
+			unsigned int head = ring->head;
+
+			ring->discarded += head - ring->tail;
+			smp_mb();
+			ring->tail = head;
+		}
+		discarding = 1;
+		goto quit;
+	}
+
+	/* undraw cursor first */
+	if (IS_VISIBLE)
+		hide_cursor(vc);
+
+	drawn = 0;
+	for_each_cpu(cpu)
+		drawn |= vt_console_drain(vc, &per_cpu(vt_kmsg_ring, cpu));
 	set_cursor(vc);
+	if (drawn)
+		vcs_changed(vc);
 
-	if (!oops_in_progress)
+	if (drawn && !oops_in_progress)
 		poke_blanked_console(vc->display_fg);
 quit:
+	if (locked)
+		__release_vt_sem(vt);
 	clear_bit(0, &printing);
+	smp_mb__after_clear_bit();
+	/*
+	 * Catch messages queued while we held the printing bit. After a
+	 * discard the drops stay pending until they can be shown, so
+	 * don't spin on them; the next printk comes back here.
+	 */
+	if (!discarding && vt_console_pending())
+		goto again;
+}
+
+void vt_console_print(struct console *co, const char *b, unsigned count)
+{
+	/* not yet initialized */
+	if (!printable)
+		return;
+
+	vt_console_queue(b, count);
+	vt_console_flush();
 }
 
 static struct tty_driver *vt_console_device(struct console *c, int *index)
@@ -1614,6 +2180,19 @@ struct console vt_console_driver = {
 };
 #endif
 
+void release_vt_sem(struct vt_struct *vt)
+{
+	__release_vt_sem(vt);
+#ifdef CONFIG_VT_CONSOLE
+	/* printk may have found this display busy and left its output */
+	smp_mb();
+	if (printable && vt_console_pending() &&
+	    vt_kmsg_vc()->display_fg == vt)
+		vt_console_flush();
+#endif
+}
+EXPORT_SYMBOL(release_vt_sem);
+
 /*
  *	Handling of Linux-specific VC ioctls
  */
@@ -1647,7 +2226,11 @@ int tioclinux(struct tty_struct *tty, unsigned long arg)
 	{
 		case TIOCL_SETSEL:
 			acquire_console_sem();
-			ret = set_selection((struct tiocl_selection __user *)(p+1), tty);
+			acquire_vt_sem(vc->display_fg);
+			ret = vc_screen_need(vc, GFP_KERNEL);
+			if (!ret)
+				ret = set_selection((struct tiocl_selection __user *)(p+1), tty);
+			release_vt_sem(vc->display_fg);
 			release_console_sem();
 			break;
 		case TIOCL_PASTESEL:
@@ -1667,7 +2250,7 @@ int tioclinux(struct tty_struct *tty, unsigned long arg)
 	 * kernel-internal variable; programs not closely
 	 * related to the kernel should not use this.
 	 */
-	 		data = shift_state;
+	 		data = vc->display_fg->kbd.shift_state;
 			ret = __put_user(data, p);
 			break;
 		case TIOCL_GETMOUSEREPORTING:
@@ -1702,7 +2285,9 @@ int tioclinux(struct tty_struct *tty, unsigned long arg)
 			break;
 		case TIOCL_BLANKSCREEN: /* until explicitly unblanked, not only poked */
 			ignore_poke = 1;
+			acquire_vt_sem(vc->display_fg);
 			do_blank_screen(vc->display_fg, 0);
+			release_vt_sem(vc->display_fg);
 			break;
 		case TIOCL_BLANKEDSCREEN:	
 			ret = vc->display_fg->vt_blanked;
@@ -1717,6 +2302,21 @@ int tioclinux(struct tty_struct *tty, unsigned long arg)
 /*
  * Mapping and unmapping displays to a VT
  */
+/*
+ * Displays found at console_init() time come up before workqueues do;
+ * they use keventd until vty_init() gives them their own.
+ */
+static int vt_wq_ready;
+
+static void vt_create_wq(struct vt_struct *vt)
+{
+	snprintf(vt->vt_wq_name, sizeof(vt->vt_wq_name), "kvt/%d", vt->vt_num);
+	vt->vt_wq = create_singlethread_workqueue(vt->vt_wq_name);
+	if (!vt->vt_wq)
+		printk(KERN_WARNING "vt%d: no workqueue, sharing keventd\n",
+		       vt->vt_num);
+}
+
 const char *vt_map_display(struct vt_struct *vt, int init, int vc_count)
 {
 	const char *display_desc;
@@ -1733,6 +2333,7 @@ const char *vt_map_display(struct vt_struct *vt, int init, int vc_count)
 	/* Now to setup VT */
 	list_add_tail(&vt->node, &vt_list);
 	init_MUTEX(&vt->lock);
+	init_MUTEX(&vt->vt_sem);
 	vt->vt_num = current_vt;
 	vt->display_desc = (char *)display_desc;
 	vt->vt_dont_switch = 0;
@@ -1746,7 +2347,10 @@ const char *vt_map_display(struct vt_struct *vt, int init, int vc_count)
 	vt->timer.function = blank_screen_t;
 	mod_timer(&vt->timer, jiffies + vt->blank_interval);
 	vt->keyboard = NULL;
+	kbd_seat_init(&vt->kbd);
 	INIT_WORK(&vt->vt_work, vt_callback, vt);
+	if (vt_wq_ready)
+		vt_create_wq(vt);
 
 	if (!admin_vt) {
 		admin_vt = vt;
@@ -1757,9 +2361,11 @@ const char *vt_map_display(struct vt_struct *vt, int init, int vc_count)
 	}
 	acquire_console_sem();
 	vt->vc_cons[0] = vc_allocate(current_vc);
+	acquire_vt_sem(vt);
 	gotoxy(vt->fg_console, vt->fg_console->vc_x, vt->fg_console->vc_y);
 	vte_ed(vt->fg_console, 0);
 	update_screen(vt->fg_console);
+	release_vt_sem(vt);
 	release_console_sem();
 	current_vc += vc_count;
 	current_vt += 1;
@@ -1790,6 +2396,7 @@ static int __init vt_console_init(void)
 {
 	int err = 0;
 	
+	vt_waitactive_init();
 #ifdef CONFIG_VGA_CONSOLE
 	err = vga_console_init();	
 #elif defined (CONFIG_DUMMY_CONSOLE)
@@ -1817,10 +2424,24 @@ static struct tty_operations vt_ops = {
 
 int __init vty_init(void)
 {
+	struct vt_struct *vt;
+
 	if (list_empty(&vt_list))
 		return -ENXIO;
+
+	vc_cachep = kmem_cache_create("vc_data", sizeof(struct vc_data), 0,
+				      SLAB_HWCACHE_ALIGN | SLAB_PANIC,
+				      NULL, NULL);
+	set_shrinker(DEFAULT_SEEKS, vc_shrink);
+
+	acquire_console_sem();
+	list_for_each_entry(vt, &vt_list, node)
+		vt_create_wq(vt);
+	vt_wq_ready = 1;
+	release_console_sem();
 	
 	vcs_init();
+	vt_event_init();
 
 	console_driver = alloc_tty_driver(MAX_NR_CONSOLES);
 	if (!console_driver)
@@ -1872,6 +2493,7 @@ int take_over_console(struct vt_struct *vt, const struct consw *csw)
 
 	/* First shutdown old console driver */
 	acquire_console_sem();
+	acquire_vt_sem(vt);
 	hide_cursor(vc);
 
 	for (i = 0; i < vt->vc_count; i++) {
@@ -1889,6 +2511,7 @@ int take_over_console(struct vt_struct *vt, const struct consw *csw)
 	if (!desc) {
 		/* Make sure the original driver state is restored to normal */
 		vt->vt_sw->con_startup(vt, 1);
+		release_vt_sem(vt);
 		release_console_sem();
 		module_put(owner);
 		return -ENODEV;
@@ -1904,6 +2527,7 @@ int take_over_console(struct vt_struct *vt, const struct consw *csw)
 		if (vc) {
 			old_was_color = vc->vc_can_do_color;
 			vc->vc_num = vt->first_vc + i;
+			compact_screen(vc);
 			vc->vc_origin = (unsigned long) vc->vc_screenbuf;
 			vc->vc_visible_origin = vc->vc_origin;
 			vc->vc_scr_end = vc->vc_origin + vc->vc_screenbuf_size;
@@ -1915,7 +2539,8 @@ int take_over_console(struct vt_struct *vt, const struct consw *csw)
 			 * the attributes in the screenbuf will be wrong.  The
 			 * following resets all attributes to something sane.
 			 */
-			if (old_was_color != vc->vc_can_do_color)
+			if (old_was_color != vc->vc_can_do_color &&
+			    vc->vc_screenbuf)
 				clear_buffer_attributes(vc);
 		}
 	}
@@ -1926,6 +2551,7 @@ int take_over_console(struct vt_struct *vt, const struct consw *csw)
 			vc->vc_can_do_color ? "colour" : "mono",
 			desc, vc->vc_cols, vc->vc_rows,
 			vt->first_vc + 1, vt->first_vc + vt->vc_count);
+	release_vt_sem(vt);
 	release_console_sem();
 	module_put(owner);
 	return 0;
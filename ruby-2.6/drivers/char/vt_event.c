@@ -0,0 +1,175 @@
+/*
+ *	linux/drivers/char/vt_event.c
+ *
+ *	/dev/vtevent: VT switches, blanking and resizes as a stream of
+ *	records, so session managers can poll() for them instead of
+ *	parking a thread in VT_WAITACTIVE per VC.
+ *
+ *	Every open file has its own queue. Events are posted from process
+ *	context as well as from the unblank paths, which may run in
+ *	interrupt context, so the queues are under an irq-safe lock.
+ */
+
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/init.h>
+#include <linux/spinlock.h>
+#include <linux/miscdevice.h>
+#include <linux/vt_kern.h>
+#include <linux/vt_event.h>
+
+#include <asm/uaccess.h>
+
+struct vt_event_reader {
+	struct list_head node;
+	unsigned int head, tail;	/* tail == head: empty */
+	int overrun;
+	struct vt_event ev[VT_EVENT_QUEUE];
+};
+
+static LIST_HEAD(vt_event_readers);
+static DEFINE_SPINLOCK(vt_event_lock);
+static DECLARE_WAIT_QUEUE_HEAD(vt_event_wait);
+
+void vt_event_post(unsigned int event, struct vt_struct *vt,
+		   unsigned int oldvc, unsigned int newvc)
+{
+	struct vt_event_reader *r;
+	struct vt_event *ev;
+	unsigned long flags;
+
+	/* An oops may have left the lock held; nobody cares then */
+	if (list_empty(&vt_event_readers) || oops_in_progress)
+		return;
+
+	spin_lock_irqsave(&vt_event_lock, flags);
+	list_for_each_entry(r, &vt_event_readers, node) {
+		if (r->head - r->tail == VT_EVENT_QUEUE) {
+			r->tail++;
+			r->overrun = 1;
+		}
+		ev = &r->ev[r->head++ % VT_EVENT_QUEUE];
+		memset(ev, 0, sizeof(*ev));
+		ev->event = event;
+		ev->display = vt->vt_num;
+		ev->oldvc = oldvc + 1;
+		ev->newvc = newvc + 1;
+	}
+	spin_unlock_irqrestore(&vt_event_lock, flags);
+	wake_up_interruptible(&vt_event_wait);
+}
+
+static int vt_event_open(struct inode *inode, struct file *file)
+{
+	struct vt_event_reader *r;
+	unsigned long flags;
+
+	r = kmalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+	r->head = r->tail = 0;
+	r->overrun = 0;
+	file->private_data = r;
+
+	spin_lock_irqsave(&vt_event_lock, flags);
+	list_add_tail(&r->node, &vt_event_readers);
+	spin_unlock_irqrestore(&vt_event_lock, flags);
+	return 0;
+}
+
+static int vt_event_release(struct inode *inode, struct file *file)
+{
+	struct vt_event_reader *r = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vt_event_lock, flags);
+	list_del(&r->node);
+	spin_unlock_irqrestore(&vt_event_lock, flags);
+	kfree(r);
+	return 0;
+}
+
+/* Take the oldest record, if any; 1 if we got one */
+static int vt_event_get(struct vt_event_reader *r, struct vt_event *ev)
+{
+	unsigned long flags;
+	int got = 0;
+
+	spin_lock_irqsave(&vt_event_lock, flags);
+	if (r->tail != r->head) {
+		*ev = r->ev[r->tail++ % VT_EVENT_QUEUE];
+		if (r->overrun) {
+			ev->event |= VT_EVENT_OVERRUN;
+			r->overrun = 0;
+		}
+		got = 1;
+	}
+	spin_unlock_irqrestore(&vt_event_lock, flags);
+	return got;
+}
+
+static ssize_t vt_event_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct vt_event_reader *r = file->private_data;
+	struct vt_event ev;
+	ssize_t read = 0;
+	int ret;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	while (count >= sizeof(ev)) {
+		if (!vt_event_get(r, &ev)) {
+			if (read)
+				break;
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(vt_event_wait,
+						       r->tail != r->head);
+			if (ret)
+				return ret;
+			continue;
+		}
+		if (copy_to_user(buf, &ev, sizeof(ev)))
+			return read ? read : -EFAULT;
+		buf += sizeof(ev);
+		count -= sizeof(ev);
+		read += sizeof(ev);
+	}
+	return read;
+}
+
+static unsigned int vt_event_poll(struct file *file, poll_table *wait)
+{
+	struct vt_event_reader *r = file->private_data;
+
+	poll_wait(file, &vt_event_wait, wait);
+	if (r->tail != r->head)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static struct file_operations vt_event_fops = {
+	.owner		= THIS_MODULE,
+	.open		= vt_event_open,
+	.release	= vt_event_release,
+	.read		= vt_event_read,
+	.poll		= vt_event_poll,
+};
+
+static struct miscdevice vt_event_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "vtevent",
+	.fops		= &vt_event_fops,
+};
+
+int __init vt_event_init(void)
+{
+	return misc_register(&vt_event_dev);
+}
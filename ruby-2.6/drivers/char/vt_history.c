@@ -0,0 +1,174 @@
+/*
+ *	linux/drivers/char/vt_history.c
+ *
+ *	Software scrollback history for the virtual consoles.
+ *
+ *	Rows scrolled off the top of a VC are run-length encoded and kept
+ *	on that VC's vc_hist list. All VCs share a single pool capped at
+ *	vt_history= KB; when it is full, the oldest rows of the whole
+ *	system are dropped first, so a chatty console eats into the history
+ *	of idle ones only once theirs is older.
+ *
+ *	Callers hold the VC's display lock (vt_sem). The shared pool, and
+ *	with it every VC's list, since a push on one display may drop rows
+ *	of another, is covered by hist_lock.
+ */
+
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/init.h>
+#include <linux/spinlock.h>
+#include <linux/console.h>
+#include <linux/vt_kern.h>
+#include <linux/vt_buffer.h>
+
+struct vc_hist_row {
+	struct list_head node;		/* On the owner's vc_hist */
+	struct list_head age;		/* On hist_age, oldest first */
+	struct vc_data *vc;		/* Owner */
+	unsigned short nruns;		/* Number of (count, cell) pairs */
+	u16 runs[0];
+};
+
+static LIST_HEAD(hist_age);
+static DEFINE_SPINLOCK(hist_lock);
+static unsigned long hist_used;
+static unsigned long hist_limit = CONFIG_VT_HISTORY_SIZE * 1024;
+
+static int __init vt_history_setup(char *str)
+{
+	hist_limit = simple_strtoul(str, NULL, 0) * 1024;
+	return 1;
+}
+
+__setup("vt_history=", vt_history_setup);
+
+static inline unsigned int row_bytes(unsigned int nruns)
+{
+	return sizeof(struct vc_hist_row) + nruns * 2 * sizeof(u16);
+}
+
+static void drop_row(struct vc_hist_row *row)
+{
+	list_del(&row->node);
+	list_del(&row->age);
+	row->vc->vc_hist_lines--;
+	hist_used -= row_bytes(row->nruns);
+	kfree(row);
+}
+
+/*
+ * Save one screen row before it scrolls away. The row is walked twice,
+ * once to size the encoding and once to fill it, so we never need a
+ * scratch buffer the width of the screen.
+ */
+void vc_history_push(struct vc_data *vc, const u16 *p)
+{
+	struct vc_hist_row *row;
+	unsigned int i, n, nruns = 1;
+	unsigned long flags;
+	u16 cell, *r;
+
+	WARN_VT_UNLOCKED(vc->display_fg);
+
+	if (!hist_limit)
+		return;
+
+	for (i = 1; i < vc->vc_cols; i++)
+		if (scr_readw(p + i) != scr_readw(p + i - 1))
+			nruns++;
+
+	row = kmalloc(row_bytes(nruns), GFP_ATOMIC);
+	if (!row)
+		return;
+	row->vc = vc;
+	row->nruns = nruns;
+
+	r = row->runs;
+	cell = scr_readw(p);
+	for (i = 1, n = 1; i < vc->vc_cols; i++) {
+		u16 c = scr_readw(p + i);
+
+		if (c == cell) {
+			n++;
+			continue;
+		}
+		*r++ = n;
+		*r++ = cell;
+		cell = c;
+		n = 1;
+	}
+	*r++ = n;
+	*r = cell;
+
+	spin_lock_irqsave(&hist_lock, flags);
+	list_add_tail(&row->node, &vc->vc_hist);
+	list_add_tail(&row->age, &hist_age);
+	vc->vc_hist_lines++;
+	hist_used += row_bytes(nruns);
+
+	while (hist_used > hist_limit && !list_empty(&hist_age))
+		drop_row(list_entry(hist_age.next, struct vc_hist_row, age));
+	spin_unlock_irqrestore(&hist_lock, flags);
+}
+
+static void expand_row(struct vc_data *vc, struct vc_hist_row *row, u16 *p)
+{
+	unsigned int i, x = 0;
+
+	for (i = 0; i < row->nruns && x < vc->vc_cols; i++) {
+		unsigned int n = row->runs[2 * i];
+		u16 cell = row->runs[2 * i + 1];
+
+		while (n-- && x < vc->vc_cols)
+			scr_writew(cell, p + x++);
+	}
+	/* The console may have been widened since the row was saved */
+	while (x < vc->vc_cols)
+		scr_writew(vc->vc_video_erase_char, p + x++);
+}
+
+/*
+ * Expand @nr rows into @p, a buffer of @nr screen rows, starting @back
+ * rows above the bottom of the history. Returns the number of rows
+ * actually filled, which is less than @nr if the history is shorter.
+ */
+unsigned int vc_history_read(struct vc_data *vc, unsigned int back,
+			     u16 *p, unsigned int nr)
+{
+	struct vc_hist_row *row;
+	struct list_head *pos = &vc->vc_hist;
+	unsigned long flags;
+	unsigned int i;
+
+	WARN_VT_UNLOCKED(vc->display_fg);
+
+	spin_lock_irqsave(&hist_lock, flags);
+	if (back > vc->vc_hist_lines)
+		back = vc->vc_hist_lines;
+	if (nr > back)
+		nr = back;
+	for (i = 0; i < back; i++)
+		pos = pos->prev;
+	for (i = 0; i < nr; i++, pos = pos->next) {
+		row = list_entry(pos, struct vc_hist_row, node);
+		expand_row(vc, row, p + i * vc->vc_cols);
+	}
+	spin_unlock_irqrestore(&hist_lock, flags);
+	return nr;
+}
+
+void vc_history_free(struct vc_data *vc)
+{
+	unsigned long flags;
+
+	WARN_VT_UNLOCKED(vc->display_fg);
+
+	spin_lock_irqsave(&hist_lock, flags);
+	while (!list_empty(&vc->vc_hist))
+		drop_row(list_entry(vc->vc_hist.next, struct vc_hist_row, node));
+	spin_unlock_irqrestore(&hist_lock, flags);
+	vc->vc_hist_view = 0;
+}
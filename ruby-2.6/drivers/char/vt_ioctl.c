@@ -25,12 +25,15 @@
 #include <linux/console.h>
 #include <linux/signal.h>
 #include <linux/timex.h>
+#include <linux/rcupdate.h>
 
 #include <asm/io.h>
 #include <asm/uaccess.h>
 
 #include <linux/vt_kern.h>
 #include <linux/kbd_diacr.h>
+#include <linux/kbmap.h>
+#include <linux/vt_event.h>
 #include <linux/selection.h>
 #include <linux/font.h>
 
@@ -63,26 +66,44 @@
 #define GPNUM (GPLAST - GPFIRST + 1)
 
 /*
- * Sometimes we want to wait until a particular VT has been activated. We
- * do it in a very simple manner. Everybody waits on a single queue and
- * get woken up at once. Those that are satisfied go on with their business,
- * while those not ready go back to sleep. Seems overkill to add a wait
- * to each vt just for this - usually this does nothing!
+ * Sometimes we want to wait until a particular VT has been activated.
+ * Each VC number has its own queue, so a switch only wakes those
+ * waiting for the VC that came to the front. The queues live here
+ * rather than in vc_data so that a waiter outlives VT_DISALLOCATE.
  */
-static DECLARE_WAIT_QUEUE_HEAD(vt_activate_queue);
+static wait_queue_head_t vt_activate_queue[MAX_NR_CONSOLES];
+
+void __init vt_waitactive_init(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_NR_CONSOLES; i++)
+		init_waitqueue_head(&vt_activate_queue[i]);
+}
+
+/* Wake the waiters for VC @num, which came to the front or went away */
+void vt_waitactive_wake(unsigned int num)
+{
+	wake_up(&vt_activate_queue[num]);
+}
 
 /*
  * Sleeps until a vt is activated, or the task is interrupted. Returns
- * 0 if activation, -EINTR if interrupted.
+ * 0 if activation, -EINTR if interrupted, -ENXIO if the VC went away.
  */
 int vt_waitactive(struct vc_data *vc)
 {
+	unsigned int num = vc->vc_num;
 	DECLARE_WAITQUEUE(wait, current);
 	int retval;
 
-	add_wait_queue(&vt_activate_queue, &wait);
+	add_wait_queue(&vt_activate_queue[num], &wait);
 	for (;;) {
 		set_current_state(TASK_INTERRUPTIBLE);
+		retval = -ENXIO;
+		vc = find_vc(num);
+		if (!vc)
+			break;
 		retval = 0;
 		if (IS_VISIBLE)
 			break;
@@ -91,11 +112,18 @@ int vt_waitactive(struct vc_data *vc)
 			break;
 		schedule();
 	}
-	remove_wait_queue(&vt_activate_queue, &wait);
+	remove_wait_queue(&vt_activate_queue[num], &wait);
 	set_current_state(TASK_RUNNING);
 	return retval;
 }
 
+/*
+ * Serializes keymap updates. KDSKBENT and KDSKBMAPS can sleep between
+ * looking at key_maps[] and changing it, and keymap_count has to match
+ * what they saw.
+ */
+static DECLARE_MUTEX(kbd_keymap_sem);
+
 #define i (tmp.kb_index)
 #define s (tmp.kb_table)
 #define v (tmp.kb_value)
@@ -104,6 +132,7 @@ do_kdsk_ioctl(struct vc_data *vc, int cmd, struct kbentry __user *user_kbe, int
 {
 	ushort *key_map, val, ov;
 	struct kbentry tmp;
+	int ret = 0;
 
 	if (copy_from_user(&tmp, user_kbe, sizeof(struct kbentry)))
 		return -EFAULT;
@@ -121,11 +150,13 @@ do_kdsk_ioctl(struct vc_data *vc, int cmd, struct kbentry __user *user_kbe, int
 	case KDSKBENT:
 		if (!perm)
 			return -EPERM;
+		down(&kbd_keymap_sem);
 		if (!i && v == K_NOSUCHMAP) {
 			/* disallocate map */
 			key_map = key_maps[s];
 			if (s && key_map) {
 				key_maps[s] = NULL;
+				kbd_keymap_changed(s, -1);
 				if (key_map[0] == U(K_ALLOCATED)) {
 					kfree(key_map);
 					keymap_count--;
@@ -136,9 +167,11 @@ do_kdsk_ioctl(struct vc_data *vc, int cmd, struct kbentry __user *user_kbe, int
 
 		if (KTYP(v) < NR_TYPES) {
 			if (KVAL(v) > max_vals[KTYP(v)])
-				return -EINVAL;
+				ret = -EINVAL;
 		} else if (vc->kbd_table.kbdmode != VC_UNICODE)
-			return -EINVAL;
+			ret = -EINVAL;
+		if (ret)
+			break;
 
 		/* ++Geert: non-PC keyboards may generate keycode zero */
 #if !defined(__mc68000__) && !defined(__powerpc__)
@@ -151,17 +184,22 @@ do_kdsk_ioctl(struct vc_data *vc, int cmd, struct kbentry __user *user_kbe, int
 			int j;
 
 			if (keymap_count >= MAX_NR_OF_USER_KEYMAPS &&
-			    !capable(CAP_SYS_RESOURCE))
-				return -EPERM;
+			    !capable(CAP_SYS_RESOURCE)) {
+				ret = -EPERM;
+				break;
+			}
 
 			key_map = (ushort *) kmalloc(sizeof(plain_map), GFP_KERNEL);
-			if (!key_map)
-				return -ENOMEM;
+			if (!key_map) {
+				ret = -ENOMEM;
+				break;
+			}
 			key_maps[s] = key_map;
 			key_map[0] = U(K_ALLOCATED);
 			for (j = 1; j < NR_KEYS; j++)
 				key_map[j] = U(K_HOLE);
 			keymap_count++;
+			kbd_keymap_changed(s, -1);
 		}
 		ov = U(key_map[i]);
 		if (v == ov)
@@ -169,19 +207,155 @@ do_kdsk_ioctl(struct vc_data *vc, int cmd, struct kbentry __user *user_kbe, int
 		/*
 		 * Attention Key.
 		 */
-		if (((ov == K_SAK) || (v == K_SAK)) && !capable(CAP_SYS_ADMIN))
-			return -EPERM;
+		if (((ov == K_SAK) || (v == K_SAK)) && !capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
 		key_map[i] = U(v);
-		if (!s && (KTYP(ov) == KT_SHIFT || KTYP(v) == KT_SHIFT))
-			compute_shiftstate();
+		kbd_keymap_changed(s, i);
+		if (!s && (KTYP(ov) == KT_SHIFT || KTYP(v) == KT_SHIFT)) {
+			struct vt_struct *vt;
+
+			list_for_each_entry(vt, &vt_list, node)
+				compute_shiftstate(vt);
+		}
 		break;
 	}
-	return 0;
+	up(&kbd_keymap_sem);
+	return ret;
 }
 #undef i
 #undef s
 #undef v
 
+/*
+ * KDSKBMAPS: the new maps are built and checked off to the side, then
+ * all go into key_maps together with one recompile of the keyboard's
+ * table, so a keystroke never sees half a keymap load. kbd_keymap_sem
+ * is held from the first look at key_maps[] to the swap.
+ */
+struct kbmaps_load {
+	struct kbmap kbm;			/* Entry being read */
+	ushort *map[MAX_NR_KEYMAPS];		/* New maps, old ones after the swap */
+	unsigned char seen[MAX_NR_KEYMAPS];
+};
+
+static int
+do_kdskbmaps_ioctl(struct vc_data *vc, struct kbmaps __user *user_kbms, int perm)
+{
+	struct kbmaps_load *ld;
+	struct kbmap *kbm;
+	int count, added = 0, shift_changed = 0;
+	int n, k, t, ret;
+
+	if (!perm)
+		return -EPERM;
+	if (get_user(count, &user_kbms->kb_count))
+		return -EFAULT;
+	if (count <= 0 || count > MAX_NR_KEYMAPS)
+		return -EINVAL;
+
+	ld = kmalloc(sizeof(*ld), GFP_KERNEL);
+	if (!ld)
+		return -ENOMEM;
+	memset(ld->map, 0, sizeof(ld->map));
+	memset(ld->seen, 0, sizeof(ld->seen));
+	kbm = &ld->kbm;
+
+	down(&kbd_keymap_sem);
+
+	for (n = 0; n < count; n++) {
+		ushort *cur;
+
+		ret = -EFAULT;
+		if (copy_from_user(kbm, &user_kbms->kb_maps[n], sizeof(*kbm)))
+			goto out_free;
+		t = kbm->kb_table;
+		ret = -EINVAL;
+		if (t >= MAX_NR_KEYMAPS || ld->seen[t]++)
+			goto out_free;
+		cur = key_maps[t];
+
+		if (kbm->kb_values[0] == K_NOSUCHMAP) {
+			if (!t)
+				goto out_free;
+			if (cur && cur[0] == U(K_ALLOCATED))
+				added--;
+			continue;
+		}
+
+		for (k = 1; k < NR_KEYS; k++) {
+			ushort v = kbm->kb_values[k];
+			ushort ov = cur ? U(cur[k]) : K_HOLE;
+
+			if (KTYP(v) < NR_TYPES) {
+				if (KVAL(v) > max_vals[KTYP(v)])
+					goto out_free;
+			} else if (vc->kbd_table.kbdmode != VC_UNICODE)
+				goto out_free;
+			/* Attention Key */
+			if (v != ov && (v == K_SAK || ov == K_SAK) &&
+			    !capable(CAP_SYS_ADMIN)) {
+				ret = -EPERM;
+				goto out_free;
+			}
+			if (!t && v != ov &&
+			    (KTYP(v) == KT_SHIFT || KTYP(ov) == KT_SHIFT))
+				shift_changed = 1;
+		}
+
+		ret = -ENOMEM;
+		ld->map[t] = kmalloc(sizeof(plain_map), GFP_KERNEL);
+		if (!ld->map[t])
+			goto out_free;
+		ld->map[t][0] = U(K_ALLOCATED);
+		for (k = 1; k < NR_KEYS; k++)
+			ld->map[t][k] = U(kbm->kb_values[k]);
+		if (!cur || cur[0] != U(K_ALLOCATED))
+			added++;
+	}
+
+	if (added > 0 && keymap_count + added > MAX_NR_OF_USER_KEYMAPS &&
+	    !capable(CAP_SYS_RESOURCE)) {
+		ret = -EPERM;
+		goto out_free;
+	}
+
+	for (t = 0; t < MAX_NR_KEYMAPS; t++) {
+		ushort *old;
+
+		if (!ld->seen[t])
+			continue;
+		old = key_maps[t];
+		key_maps[t] = ld->map[t];
+		ld->map[t] = old;
+	}
+	keymap_count += added;
+	kbd_keymap_changed(0, -1);
+	/* Without a compiled table kbd_keycode() reads key_maps directly */
+	synchronize_rcu();
+
+	for (t = 0; t < MAX_NR_KEYMAPS; t++)
+		if (ld->map[t] && ld->map[t][0] == U(K_ALLOCATED))
+			kfree(ld->map[t]);
+	if (shift_changed) {
+		struct vt_struct *vt;
+
+		list_for_each_entry(vt, &vt_list, node)
+			compute_shiftstate(vt);
+	}
+	up(&kbd_keymap_sem);
+	kfree(ld);
+	return 0;
+
+out_free:
+	up(&kbd_keymap_sem);
+	for (t = 0; t < MAX_NR_KEYMAPS; t++)
+		kfree(ld->map[t]);
+	kfree(ld);
+	return ret;
+}
+
 static inline int 
 do_kbkeycode_ioctl(struct vc_data *vc, int cmd, struct kbkeycode __user *user_kbkc, int perm)
 {
@@ -340,12 +514,12 @@ int con_font_get(struct vc_data *vc, struct console_font_op *op)
 	} else
 		font.data = NULL;
 
-	acquire_console_sem();
+	acquire_vt_sem(vc->display_fg);
 	if (vc->display_fg->vt_sw->con_font_get)
 		rc = vc->display_fg->vt_sw->con_font_get(vc, &font);
 	else
 		rc = -ENOSYS;
-	release_console_sem();
+	release_vt_sem(vc->display_fg);
 
 	if (rc)
 		goto out;
@@ -425,12 +599,12 @@ nonzero:
 		kfree(font.data);
 		return -EFAULT;
 	}
-	acquire_console_sem();
+	acquire_vt_sem(vc->display_fg);
 	if (vc->display_fg->vt_sw->con_font_set)
 		rc = vc->display_fg->vt_sw->con_font_set(vc, &font, op->flags);
 	else
 		rc = -ENOSYS;
-	release_console_sem();
+	release_vt_sem(vc->display_fg);
 	kfree(font.data);
 	return rc;
 }
@@ -452,12 +626,12 @@ int con_font_default(struct vc_data *vc, struct console_font_op *op)
 	else
 		name[MAX_FONT_NAME - 1] = 0;
 
-	acquire_console_sem();
+	acquire_vt_sem(vc->display_fg);
 	if (vc->display_fg->vt_sw->con_font_default)
 		rc = vc->display_fg->vt_sw->con_font_default(vc, &font, s);
 	else
 		rc = -ENOSYS;
-	release_console_sem();
+	release_vt_sem(vc->display_fg);
 	if (!rc) {
 		op->width = font.width;
 		op->height = font.height;
@@ -480,8 +654,12 @@ int con_font_copy(struct vc_data *vc, struct console_font_op *op)
 		rc = -ENOTTY;
 	else if (con == vc->vc_num)	/* nothing to do */
 		rc = 0;
-	else
+	else {
+		/* con may be on another display: hence the console sem */
+		acquire_vt_sem(vc->display_fg);
 		rc = vc->display_fg->vt_sw->con_font_copy(vc, con);
+		release_vt_sem(vc->display_fg);
+	}
 	release_console_sem();
 	return rc;
 }
@@ -573,13 +751,12 @@ int con_set_cmap(struct vc_data *vc, unsigned char __user *arg)
 	int red[16], green[16], blue[16];
 	int i, j, k;
 
-	WARN_CONSOLE_UNLOCKED();
-	
 	for (i = 0; i < 16; i++) {
 		get_user(red[i], arg++);
 		get_user(green[i], arg++);
 		get_user(blue[i], arg++);
 	}
+	acquire_vt_sem(vc->display_fg);
 	for (i = 0; i < vc->display_fg->vc_count; i++) {
 		struct vc_data *tmp = vc->display_fg->vc_cons[i];
 		
@@ -592,6 +769,7 @@ int con_set_cmap(struct vc_data *vc, unsigned char __user *arg)
 		}
 	}
 	set_palette(vc->display_fg->fg_console);
+	release_vt_sem(vc->display_fg);
 	return 0;
 }
 
@@ -629,7 +807,7 @@ inline void switch_screen(struct vc_data *new_vc, struct vc_data *old_vc)
         }
         set_cursor(new_vc);
         set_leds();
-        compute_shiftstate();
+        compute_shiftstate(new_vc->display_fg);
 }
 
 /*
@@ -697,12 +875,17 @@ void change_console(struct vc_data *new_vc, struct vc_data *old_vc)
 }
 
 /*
- * Performs the back end of a vt switch
+ * Performs the back end of a vt switch. The caller holds the display's
+ * vt_sem.
  */
 void complete_change_console(struct vc_data *new_vc, struct vc_data *old_vc)
 {
 	unsigned char old_vc_mode;
 
+	WARN_VT_UNLOCKED(new_vc->display_fg);
+	/* Callers give the new VC its screen before starting the switch */
+	BUG_ON(!new_vc->vc_screenbuf);
+
 	new_vc->display_fg->last_console = old_vc;
 
 	/*
@@ -724,12 +907,10 @@ void complete_change_console(struct vc_data *new_vc, struct vc_data *old_vc)
 	 * controlling process is gone and we've called reset_vc.
 	 */
 	if (old_vc_mode != new_vc->vc_mode) {
-		acquire_console_sem();
 		if (new_vc->vc_mode == KD_TEXT)
 			unblank_vt(new_vc->display_fg);
 		else
 			do_blank_screen(new_vc->display_fg, 1);
-		release_console_sem();
 	}
 
 	/*
@@ -766,9 +947,14 @@ void complete_change_console(struct vc_data *new_vc, struct vc_data *old_vc)
 	}
 
 	/*
-	 * Wake anyone waiting for their VT to activate
+	 * Wake anyone waiting for this VT to activate
 	 */
-	wake_up(&vt_activate_queue);
+	vt_waitactive_wake(new_vc->vc_num);
+	/* /dev/vcs0 and the vcsa shadows follow the front VC */
+	vcs_changed(old_vc);
+	vcs_changed(new_vc);
+	vt_event_post(VT_EVENT_SWITCH, new_vc->display_fg,
+		      old_vc->vc_num, new_vc->vc_num);
 	return;
 }
 
@@ -903,12 +1089,12 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 		/*
 		 * explicitly blank/unblank the screen if switching modes
 		 */
-		acquire_console_sem();
+		acquire_vt_sem(vc->display_fg);
 		if (arg == KD_TEXT)
 			unblank_vt(vc->display_fg);
 		else
 			do_blank_screen(vc->display_fg, 1);
-		release_console_sem();
+		release_vt_sem(vc->display_fg);
 		return 0;
 
 	case KDGETMODE:
@@ -935,11 +1121,11 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 			break;
 		  case K_XLATE:
 			vc->kbd_table.kbdmode = VC_XLATE;
-			compute_shiftstate();
+			compute_shiftstate(vc->display_fg);
 			break;
 		  case K_UNICODE:
 			vc->kbd_table.kbdmode = VC_UNICODE;
-			compute_shiftstate();
+			compute_shiftstate(vc->display_fg);
 			break;
 		  default:
 			return -EINVAL;
@@ -984,6 +1170,9 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 	case KDSKBENT:
 		return do_kdsk_ioctl(vc, cmd, up, perm);
 
+	case KDSKBMAPS:
+		return do_kdskbmaps_ioctl(vc, up, perm);
+
 	case KDGKBSENT:
 	case KDSKBSENT:
 		return do_kdgkb_ioctl(cmd, up, perm);
@@ -1074,14 +1263,14 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 			return -EFAULT;
 		if (tmp.mode != VT_AUTO && tmp.mode != VT_PROCESS)
 			return -EINVAL;
-		acquire_console_sem();
+		acquire_vt_sem(vc->display_fg);
 		vc->vt_mode = tmp;
 		/* the frsig is ignored, so we set it to 0 */
 		vc->vt_mode.frsig = 0;
 		vc->vt_pid = current->pid;
 		/* no switch is required -- saw@shade.msu.ru */
 		vc->vt_newvt = -1;
-		release_console_sem();
+		release_vt_sem(vc->display_fg);
 		return 0;
 	}
 
@@ -1089,9 +1278,9 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 	{
 		struct vt_mode tmp;
 
-		acquire_console_sem();
+		acquire_vt_sem(vc->display_fg);
 		memcpy(&tmp, &vc->vt_mode, sizeof(struct vt_mode));
-		release_console_sem();
+		release_vt_sem(vc->display_fg);
 		return copy_to_user(up, &tmp, sizeof(struct vt_mode)) ? -EFAULT : 0;
 	}
 
@@ -1219,13 +1408,21 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 						return i;
 					}
 				}
-				vc->vt_newvt = -1;
 				/*
 				 * When we actually do the console switch,
 				 * make sure we are atomic with respect to
 				 * other console switches..
 				 */
+				acquire_vt_sem(vc->display_fg);
+				/* Leave vt_newvt set so the release can be retried */
+				if (vc_screen_need(tmp, GFP_KERNEL)) {
+					release_vt_sem(vc->display_fg);
+					release_console_sem();
+					return -ENOMEM;
+				}
+				vc->vt_newvt = -1;
 				complete_change_console(tmp, vc->display_fg->fg_console);
+				release_vt_sem(vc->display_fg);
 				release_console_sem();
 			}
 		} else {
@@ -1280,9 +1477,9 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 		for (i = 0; i < vc->display_fg->vc_count; i++) {
 			struct vc_data *tmp = vc->display_fg->vc_cons[i];
 
-			acquire_console_sem();
+			acquire_vt_sem(vc->display_fg);
 			vc_resize(tmp, cc, ll);
-			release_console_sem();
+			release_vt_sem(vc->display_fg);
 		}
 		return 0;
 	}
@@ -1325,13 +1522,13 @@ int vt_ioctl(struct tty_struct *tty, struct file * file,
 		for (i = 0; i < vc->display_fg->vc_count; i++) {
 			struct vc_data *tmp = vc->display_fg->vc_cons[i];
 
-			acquire_console_sem();
+			acquire_vt_sem(vc->display_fg);
 			if (vlin)
 				tmp->vc_scan_lines = vlin;
 			if (clin)
 				tmp->vc_font.height = clin;
 			vc_resize(tmp, cc, ll);
-			release_console_sem();
+			release_vt_sem(vc->display_fg);
 		}
 		return 0;
 	}
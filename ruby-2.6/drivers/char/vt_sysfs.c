@@ -7,6 +7,7 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/list.h>
+#include <linux/console.h>
 #include <linux/vt_kern.h>
 #include <linux/input.h>
 
@@ -45,6 +46,84 @@ vt_show_keyboard (struct class_device *dev, char *buf)
 }
 static CLASS_DEVICE_ATTR(keyboard, S_IRUGO, vt_show_keyboard, NULL);
 
+/*
+ * Output statistics. The counters are only written under the display's
+ * vt_sem, but taking it here would show up in the very lock figures
+ * being read, so they are read as they stand: a count may be a write
+ * behind its neighbours. The console sem only keeps VCs from going
+ * away underneath us. The 64-bit lock times are read again if a
+ * release of vt_sem lands in between.
+ */
+static ssize_t
+vt_show_stats (struct class_device *dev, char *buf)
+{
+	struct vt_struct *vt;
+	struct vc_stats st;
+	unsigned long long ns, max;
+	unsigned long count;
+	int i;
+
+	vt = to_vt_struct (dev);
+	acquire_console_sem();
+	st = vt->vt_stats;
+	for (i = 0; i < vt->vc_count; i++)
+		if (vt->vc_cons[i])
+			vc_stats_add(&st, &vt->vc_cons[i]->vc_stats);
+	release_console_sem();
+	do {
+		count = vt->vt_lock_count;
+		smp_rmb();
+		ns = vt->vt_lock_ns;
+		max = vt->vt_lock_max;
+		smp_rmb();
+	} while (count != vt->vt_lock_count);
+
+	return sprintf (buf, "bytes %lu\nglyphs %lu\nputcs %lu\nputcs_cells %lu\n"
+			"scroll_hw %lu\nscroll_soft %lu\nscroll_copy %lu\n"
+			"escapes %lu\nlock_count %lu\nlock_ns %llu\n"
+			"lock_max_ns %llu\n",
+			st.bytes, st.glyphs, st.putcs, st.putcs_cells,
+			st.scroll_hw, st.scroll_soft, st.scroll_copy,
+			st.escapes, count, ns, max);
+}
+static CLASS_DEVICE_ATTR(stats, S_IRUGO, vt_show_stats, NULL);
+
+/*
+ * One line per allocated VC: tty number, bytes, glyphs, putcs calls,
+ * putcs cells, hardware, origin and memmove scrolls, escapes. Freed
+ * VCs only show up in the display's totals.
+ */
+static ssize_t
+vt_show_vc_stats (struct class_device *dev, char *buf)
+{
+	struct vt_struct *vt;
+	ssize_t len = 0;
+	int i;
+
+	vt = to_vt_struct (dev);
+	acquire_console_sem();
+	for (i = 0; i < vt->vc_count; i++) {
+		struct vc_data *vc = vt->vc_cons[i];
+		struct vc_stats *st;
+
+		if (!vc)
+			continue;
+		st = &vc->vc_stats;
+		len += snprintf (buf + len, PAGE_SIZE - len,
+				 "%d %lu %lu %lu %lu %lu %lu %lu %lu\n",
+				 vc->vc_num + 1, st->bytes, st->glyphs,
+				 st->putcs, st->putcs_cells, st->scroll_hw,
+				 st->scroll_soft, st->scroll_copy, st->escapes);
+		if (len >= PAGE_SIZE) {
+			len = PAGE_SIZE - 1;
+			break;
+		}
+	}
+	release_console_sem();
+	return len;
+}
+static CLASS_DEVICE_ATTR(vc_stats, S_IRUGO, vt_show_vc_stats, NULL);
+
 int __init vt_create_sysfs_dev_files (struct vt_struct *vt)
 {
 	struct class_device *dev = &vt->dev;
@@ -58,6 +137,8 @@ int __init vt_create_sysfs_dev_files (struct vt_struct *vt)
 	class_device_create_file (dev, &class_device_attr_first_vc);
 	class_device_create_file (dev, &class_device_attr_vc_count);
 	class_device_create_file (dev, &class_device_attr_keyboard);
+	class_device_create_file (dev, &class_device_attr_stats);
+	class_device_create_file (dev, &class_device_attr_vc_stats);
 
 	return 0;
 }
@@ -14,7 +14,12 @@
 #include <linux/sched.h>
 #include <linux/smp_lock.h>
 #include <linux/input.h>
+#include <linux/input_core.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/hash.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
 #include <linux/random.h>
 #include <linux/major.h>
 #include <linux/proc_fs.h>
@@ -24,6 +29,9 @@
 #include <linux/device.h>
 #include <linux/devfs_fs_kernel.h>
 
+#include <asm/div64.h>
+#include <asm/uaccess.h>
+
 MODULE_AUTHOR("Vojtech Pavlik <vojtech@suse.cz>");
 MODULE_DESCRIPTION("Input core");
 MODULE_LICENSE("GPL");
@@ -40,6 +48,9 @@ EXPORT_SYMBOL(input_accept_process);
 EXPORT_SYMBOL(input_flush_device);
 EXPORT_SYMBOL(input_event);
 EXPORT_SYMBOL(input_class);
+EXPORT_SYMBOL(input_set_events_handler);
+EXPORT_SYMBOL(input_set_abs_filter);
+EXPORT_SYMBOL(input_get_abs_filter);
 
 #define INPUT_DEVICES	256
 
@@ -48,6 +59,716 @@ static LIST_HEAD(input_handler_list);
 
 static struct input_handler *input_table[8];
 
+/*
+ * Frame batching: filtered events are buffered per device until
+ * SYN_REPORT and then handed to each handler in one go. Events going
+ * to the device (LEDs, sound, repeat, force feedback) are passed on
+ * right away, and so is everything from a device until it has sent
+ * its first SYN_REPORT, since drivers that never send one would
+ * otherwise be held back. frames=0 turns batching off.
+ */
+static int input_frames = 1;
+module_param_named(frames, input_frames, bool, 0644);
+MODULE_PARM_DESC(frames, "Deliver events to handlers a frame at a time");
+
+#define INPUT_FRAME_MAX		64
+#define INPUT_STATE_HASH_BITS	5
+#define INPUT_LAT_BUCKETS	12	/* <1us, <2us, <4us ... >=1ms */
+
+/*
+ * Statistics are per CPU so the fast path never bounces a cache line;
+ * /proc/bus/input/stats adds them up.
+ */
+struct input_dev_stats {
+	unsigned long events[EV_MAX + 1];	/* Passed the filters */
+	unsigned long dropped;			/* Eaten by the filters */
+	unsigned long frames;			/* SYN_REPORTs passed on */
+};
+
+struct input_abs_pipe;
+
+struct input_dev_state {
+	struct hlist_node node;
+	struct input_dev *dev;
+	struct input_dev_stats *stats;		/* Per CPU */
+	struct input_abs_pipe *abs_pipe[ABS_MAX + 1];	/* Under lock */
+	struct list_head repeat_node;		/* On input_repeat_list */
+	unsigned long long repeat_due;		/* sched_clock() of the next repeat */
+	unsigned long window;			/* Start of the current second */
+	unsigned int window_frames;
+	unsigned int rate;			/* Frames in the last full second */
+	int synced;				/* Has sent a SYN_REPORT */
+	spinlock_t lock;			/* The frame buffers below */
+	int passing;				/* A frame is being passed on */
+	int passer;				/* By this CPU */
+	int complete;				/* vals[cur] is ready to go */
+	unsigned int cur;			/* Buffer being filled */
+	unsigned int count;			/* Events in it */
+	struct input_value vals[2][INPUT_FRAME_MAX];
+};
+
+static struct hlist_head input_dev_states[1 << INPUT_STATE_HASH_BITS];
+static DEFINE_SPINLOCK(input_state_lock);
+
+/* Devices with a key repeating, see input_repeat_tick() */
+static LIST_HEAD(input_repeat_list);
+static DEFINE_SPINLOCK(input_repeat_lock);
+
+struct input_handler_lat {
+	unsigned long calls;
+	unsigned long hist[INPUT_LAT_BUCKETS];
+};
+
+struct input_match_entry;
+
+struct input_handler_state {
+	struct list_head node;
+	struct input_handler *handler;
+	input_events_t events;
+	struct input_handler_lat *lat;		/* Per CPU */
+
+	struct input_match_entry *entries;	/* Compiled id_table + blacklist */
+	unsigned int nentries;
+	int indexed;
+	unsigned int seq;			/* Registration order */
+
+	/* Scratch for input_connect_indexed() */
+	struct list_head match_node;
+	unsigned int gen;
+	struct input_device_id *best;
+	unsigned int best_index;
+	int blocked;
+};
+
+static LIST_HEAD(input_handler_states);
+
+static struct input_dev_state *input_dev_state(struct input_dev *dev)
+{
+	struct hlist_head *head = &input_dev_states[hash_ptr(dev, INPUT_STATE_HASH_BITS)];
+	struct input_dev_state *st;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(st, n, head, node)
+		if (st->dev == dev)
+			return st;
+	return NULL;
+}
+
+static void input_attach_state(struct input_dev *dev)
+{
+	struct input_dev_state *st;
+	unsigned long flags;
+
+	if (!(st = kmalloc(sizeof(struct input_dev_state), GFP_KERNEL)))
+		return;		/* We just lose batching for this device */
+	memset(st, 0, sizeof(struct input_dev_state));
+	if (!(st->stats = alloc_percpu(struct input_dev_stats))) {
+		kfree(st);
+		return;
+	}
+	st->dev = dev;
+	st->window = jiffies;
+	spin_lock_init(&st->lock);
+	INIT_LIST_HEAD(&st->repeat_node);
+
+	spin_lock_irqsave(&input_state_lock, flags);
+	hlist_add_head_rcu(&st->node, &input_dev_states[hash_ptr(dev, INPUT_STATE_HASH_BITS)]);
+	spin_unlock_irqrestore(&input_state_lock, flags);
+}
+
+static void input_detach_state(struct input_dev *dev)
+{
+	struct input_dev_state *st;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&input_state_lock, flags);
+	st = input_dev_state(dev);
+	if (st)
+		hlist_del_rcu(&st->node);
+	spin_unlock_irqrestore(&input_state_lock, flags);
+
+	if (st) {
+		spin_lock_irqsave(&input_repeat_lock, flags);
+		list_del_init(&st->repeat_node);
+		spin_unlock_irqrestore(&input_repeat_lock, flags);
+
+		synchronize_rcu();
+		for (i = 0; i <= ABS_MAX; i++)
+			kfree(st->abs_pipe[i]);
+		free_percpu(st->stats);
+		kfree(st);
+	}
+}
+
+/*
+ * Autorepeat. All devices share one timer; each device holding a key
+ * down sits on input_repeat_list with the sched_clock() time its next
+ * repeat is due. Deadlines advance by exactly REP_PERIOD, so the rate
+ * doesn't drift by the jiffy rounding of mod_timer(), and a tick emits
+ * every repeat that came due since the last one as a single frame.
+ * Devices nobody has open are dropped from the list.
+ */
+
+#define INPUT_REPEAT_BATCH	8	/* Repeats per device per tick */
+#define INPUT_REPEAT_DEVS	8	/* Devices per pass over the list */
+
+struct input_repeat {
+	struct input_dev *dev;
+	unsigned int key;
+	unsigned int n;
+};
+
+static void input_repeat_tick(unsigned long data);
+
+static struct timer_list input_repeat_timer = TIMER_INITIALIZER(input_repeat_tick, 0, 0);
+
+static int input_dev_listened(struct input_dev *dev)
+{
+	struct input_handle *handle;
+
+	if (dev->grab)
+		return 1;
+	list_for_each_entry(handle, &dev->h_list, d_node)
+		if (handle->open)
+			return 1;
+	return 0;
+}
+
+/* Called with input_repeat_lock held */
+static void input_repeat_arm(unsigned long long now)
+{
+	struct input_dev_state *st;
+	unsigned long long due = ~0ULL, delta;
+
+	list_for_each_entry(st, &input_repeat_list, repeat_node)
+		if (st->repeat_due < due)
+			due = st->repeat_due;
+
+	if (due == ~0ULL)
+		return;
+
+	delta = due > now ? due - now : 0;
+	delta += NSEC_PER_SEC / HZ - 1;
+	do_div(delta, NSEC_PER_SEC / HZ);
+	mod_timer(&input_repeat_timer, jiffies + (delta ? delta : 1));
+}
+
+static void input_repeat_start(struct input_dev_state *st)
+{
+	unsigned long long now = sched_clock();
+	unsigned long flags;
+
+	spin_lock_irqsave(&input_repeat_lock, flags);
+	st->repeat_due = now + st->dev->rep[REP_DELAY] * 1000000ULL;
+	if (list_empty(&st->repeat_node))
+		list_add_tail(&st->repeat_node, &input_repeat_list);
+	input_repeat_arm(now);
+	spin_unlock_irqrestore(&input_repeat_lock, flags);
+}
+
+/*
+ * The lock only covers picking the repeats that are due and moving
+ * the deadlines on; the events are sent after dropping it, since the
+ * handlers they reach may start or stop repeats themselves. The devices
+ * can't go away meanwhile: input_detach_state() waits for RCU.
+ */
+static void input_repeat_tick(unsigned long data)
+{
+	struct input_repeat due[INPUT_REPEAT_DEVS];
+	struct input_dev_state *st, *next;
+	struct input_dev *dev;
+	unsigned long long now = sched_clock(), period;
+	unsigned long flags;
+	int i, n, nr, more;
+
+	rcu_read_lock();
+	do {
+		nr = more = 0;
+		spin_lock_irqsave(&input_repeat_lock, flags);
+		list_for_each_entry_safe(st, next, &input_repeat_list, repeat_node) {
+
+			dev = st->dev;
+
+			if (!test_bit(dev->repeat_key, dev->key) || !dev->rep[REP_PERIOD] ||
+			    !input_dev_listened(dev)) {
+				list_del_init(&st->repeat_node);
+				continue;
+			}
+
+			if (st->repeat_due > now)
+				continue;
+			if (nr == INPUT_REPEAT_DEVS) {
+				more = 1;
+				break;
+			}
+
+			period = dev->rep[REP_PERIOD] * 1000000ULL;
+			for (n = 0; st->repeat_due <= now && n < INPUT_REPEAT_BATCH; n++)
+				st->repeat_due += period;
+
+			/* Too far behind to catch up; start the rhythm afresh */
+			if (st->repeat_due <= now)
+				st->repeat_due = now + period;
+
+			due[nr].dev = dev;
+			due[nr].key = dev->repeat_key;
+			due[nr].n = n;
+			nr++;
+		}
+		spin_unlock_irqrestore(&input_repeat_lock, flags);
+
+		for (i = 0; i < nr; i++) {
+			for (n = 0; n < due[i].n; n++)
+				input_event(due[i].dev, EV_KEY, due[i].key, 2);
+			input_sync(due[i].dev);
+		}
+	} while (more);
+
+	spin_lock_irqsave(&input_repeat_lock, flags);
+	input_repeat_arm(now);
+	spin_unlock_irqrestore(&input_repeat_lock, flags);
+	rcu_read_unlock();
+}
+
+static void input_count_frame(struct input_dev_state *st)
+{
+	per_cpu_ptr(st->stats, smp_processor_id())->frames++;
+
+	if (time_after_eq(jiffies, st->window + HZ)) {
+		st->rate = time_before(jiffies, st->window + 2 * HZ) ? st->window_frames : 0;
+		st->window = jiffies;
+		st->window_frames = 0;
+	}
+	st->window_frames++;
+}
+
+static struct input_handler_state *input_find_handler_state(struct input_handler *handler)
+{
+	struct input_handler_state *hs;
+
+	list_for_each_entry(hs, &input_handler_states, node)
+		if (hs->handler == handler)
+			return hs;
+	return NULL;
+}
+
+static struct input_handler_state *input_handler_state(struct input_handler *handler)
+{
+	struct input_handler_state *hs;
+
+	if ((hs = input_find_handler_state(handler)))
+		return hs;
+
+	if (!(hs = kmalloc(sizeof(struct input_handler_state), GFP_KERNEL)))
+		return NULL;
+	memset(hs, 0, sizeof(struct input_handler_state));
+	if (!(hs->lat = alloc_percpu(struct input_handler_lat))) {
+		kfree(hs);
+		return NULL;
+	}
+	hs->handler = handler;
+	list_add_tail_rcu(&hs->node, &input_handler_states);
+	return hs;
+}
+
+int input_set_events_handler(struct input_handler *handler, input_events_t events)
+{
+	struct input_handler_state *hs = input_handler_state(handler);
+
+	if (!hs)
+		return -ENOMEM;
+	hs->events = events;
+	return 0;
+}
+
+static void input_free_handler_state(struct input_handler *handler)
+{
+	struct input_handler_state *hs = input_find_handler_state(handler);
+
+	if (!hs)
+		return;
+	list_del_rcu(&hs->node);
+	synchronize_rcu();
+	free_percpu(hs->lat);
+	kfree(hs);
+}
+
+static void input_record_latency(struct input_handler_state *hs, unsigned long long t)
+{
+	struct input_handler_lat *lat = per_cpu_ptr(hs->lat, smp_processor_id());
+	unsigned long us = (unsigned long)(sched_clock() - t) >> 10;
+	int b = us ? fls(min(us, 1UL << 20)) : 0;
+
+	lat->calls++;
+	lat->hist[min(b, INPUT_LAT_BUCKETS - 1)]++;
+}
+
+static void input_pass_handle(struct input_handle *handle,
+			      const struct input_value *vals, unsigned int count)
+{
+	struct input_handler_state *hs;
+	unsigned long long t = sched_clock();
+	unsigned int i;
+
+	list_for_each_entry_rcu(hs, &input_handler_states, node)
+		if (hs->handler == handle->handler)
+			break;
+	if (&hs->node == &input_handler_states)
+		hs = NULL;
+
+	if (hs && hs->events)
+		hs->events(handle, vals, count);
+	else
+		for (i = 0; i < count; i++)
+			handle->handler->event(handle, vals[i].type, vals[i].code, vals[i].value);
+
+	if (hs)
+		input_record_latency(hs, t);
+}
+
+static void input_pass_values(struct input_dev *dev,
+			      const struct input_value *vals, unsigned int count)
+{
+	struct input_handle *handle;
+
+	if (dev->grab)
+		input_pass_handle(dev->grab, vals, count);
+	else
+		list_for_each_entry(handle, &dev->h_list, d_node)
+			if (handle->open)
+				input_pass_handle(handle, vals, count);
+}
+
+/*
+ * ABS filter pipelines. Filter state is kept in 1/256 units; time
+ * between values is measured with sched_clock(), so the EMA-style
+ * stages adapt to the rate the device actually reports at. The pipes
+ * only run, and are only swapped, under the device's st->lock, and
+ * input_event() picks the pipe or the built-in filter for a value in
+ * the same hold, so a swap never catches a value half way.
+ */
+
+#define INPUT_ABS_TAU	159154943	/* 1e9 / 2pi: mHz * us to radians */
+
+struct input_abs_stage_state {
+	s64 x;				/* Last output, << 8 */
+	s64 dx;				/* Its rate of change per second, << 8 */
+	int primed;
+};
+
+struct input_abs_pipe {
+	struct input_abs_filter cfg;
+	unsigned long long last;	/* sched_clock() of the last value */
+	struct input_abs_stage_state s[INPUT_ABS_FILTER_STAGES];
+};
+
+static s64 input_sdiv(s64 a, u32 b)
+{
+	u64 u = a < 0 ? -a : a;
+
+	do_div(u, b);
+	return a < 0 ? -(s64)u : (s64)u;
+}
+
+/* Smoothing factor in 1/65536 of a low-pass at @fc mHz sampled @dt us apart */
+static u32 input_abs_alpha(u32 fc, u32 dt)
+{
+	u64 k = (u64)fc * dt;
+
+	if (k >= 0xffffffffULL - INPUT_ABS_TAU)
+		return 65536;
+	k <<= 16;
+	do_div(k, (u32)((u64)fc * dt) + INPUT_ABS_TAU);
+	return k;
+}
+
+static int input_abs_stage(struct input_dev *dev, struct input_abs_pipe *pipe,
+			   int n, s32 *value, u32 dt)
+{
+	struct input_abs_stage *stage = &pipe->cfg.stage[n];
+	struct input_abs_stage_state *s = &pipe->s[n];
+	s64 x = (s64)*value << 8;
+	s64 dx;
+	s32 old, fuzz;
+	u64 fc;
+
+	if (!s->primed && stage->type != INPUT_ABS_FILTER_DEADBAND) {
+		s->x = x;
+		s->dx = 0;
+		s->primed = 1;
+		return 1;
+	}
+
+	switch (stage->type) {
+
+		case INPUT_ABS_FILTER_FUZZ:
+
+			old = s->x >> 8;
+			fuzz = stage->param[0] ? stage->param[0] : dev->absfuzz[pipe->cfg.axis];
+
+			if (fuzz) {
+				if ((*value > old - (fuzz >> 1)) && (*value < old + (fuzz >> 1)))
+					return 0;
+
+				if ((*value > old - fuzz) && (*value < old + fuzz))
+					*value = (old * 3 + *value) >> 2;
+
+				if ((*value > old - (fuzz << 1)) && (*value < old + (fuzz << 1)))
+					*value = (old + *value) >> 1;
+			}
+			s->x = (s64)*value << 8;
+			break;
+
+		case INPUT_ABS_FILTER_EMA:
+
+			s->x += ((x - s->x) * stage->param[0]) >> 8;
+			*value = (s->x + 128) >> 8;
+			break;
+
+		case INPUT_ABS_FILTER_DEADBAND:
+
+			if (*value >= stage->param[0] - stage->param[1] &&
+			    *value <= stage->param[0] + stage->param[1])
+				*value = stage->param[0];
+			break;
+
+		case INPUT_ABS_FILTER_ONE_EURO:
+
+			/* Keep the speed within 2^32 units/s so nothing overflows */
+			dx = input_sdiv((x - s->x) * 1000000, dt);
+			dx = max(min(dx, 1LL << 40), -(1LL << 40));
+			s->dx += (dx - s->dx) * input_abs_alpha(stage->param[2] ? stage->param[2] : 1000, dt) >> 16;
+
+			fc = stage->param[0] + (u64)stage->param[1] * ((s->dx < 0 ? -s->dx : s->dx) >> 8);
+			s->x += (x - s->x) * input_abs_alpha(min(fc, 1000000ULL), dt) >> 16;
+			*value = (s->x + 128) >> 8;
+			break;
+	}
+
+	return 1;
+}
+
+static int input_run_abs_pipe(struct input_dev *dev, struct input_abs_pipe *pipe,
+			      struct input_value *v, unsigned long long now)
+{
+	unsigned long long delta = now - pipe->last;
+	s32 value = v->value;
+	u32 dt;
+	int i;
+
+	/* Values more than 100ms apart are treated as 100ms apart */
+	if (!pipe->last || delta > 100000000ULL)
+		dt = 100000;
+	else {
+		do_div(delta, 1000);
+		dt = delta ? delta : 1;
+	}
+	pipe->last = now;
+
+	for (i = 0; i < pipe->cfg.nstages; i++)
+		if (!input_abs_stage(dev, pipe, i, &value, dt))
+			return 0;
+
+	if (dev->abs[v->code] == value)
+		return 0;
+
+	dev->abs[v->code] = v->value = value;
+	return 1;
+}
+
+/* The core's own absfuzz smoothing. Returns 0 if the value is dropped */
+static int input_fuzz_abs(struct input_dev *dev, struct input_value *v)
+{
+	unsigned int code = v->code;
+	int value = v->value;
+
+	if (dev->absfuzz[code]) {
+		if ((value > dev->abs[code] - (dev->absfuzz[code] >> 1)) &&
+		    (value < dev->abs[code] + (dev->absfuzz[code] >> 1)))
+			return 0;
+
+		if ((value > dev->abs[code] - dev->absfuzz[code]) &&
+		    (value < dev->abs[code] + dev->absfuzz[code]))
+			value = (dev->abs[code] * 3 + value) >> 2;
+
+		if ((value > dev->abs[code] - (dev->absfuzz[code] << 1)) &&
+		    (value < dev->abs[code] + (dev->absfuzz[code] << 1)))
+			value = (dev->abs[code] + value) >> 1;
+	}
+
+	if (dev->abs[code] == value)
+		return 0;
+
+	dev->abs[code] = v->value = value;
+	return 1;
+}
+
+/*
+ * Filter one ABS value through its axis' pipeline, or the built-in
+ * filter if it has none. Called with st->lock held. Returns 0 if the
+ * value is dropped.
+ */
+static int input_filter_abs(struct input_dev_state *st, struct input_value *v)
+{
+	struct input_abs_pipe *pipe = st->abs_pipe[v->code];
+
+	if (!pipe)
+		return input_fuzz_abs(st->dev, v);
+	return input_run_abs_pipe(st->dev, pipe, v, sched_clock());
+}
+
+static int input_check_abs_filter(struct input_dev *dev, const struct input_abs_filter *f)
+{
+	const struct input_abs_stage *stage;
+	int i;
+
+	if (f->axis > ABS_MAX || !test_bit(f->axis, dev->absbit))
+		return -EINVAL;
+	if (f->nstages > INPUT_ABS_FILTER_STAGES)
+		return -EINVAL;
+
+	for (i = 0; i < f->nstages; i++) {
+		stage = &f->stage[i];
+		switch (stage->type) {
+			case INPUT_ABS_FILTER_FUZZ:
+				if (stage->param[0] < 0)
+					return -EINVAL;
+				break;
+			case INPUT_ABS_FILTER_EMA:
+				if (stage->param[0] < 1 || stage->param[0] > 256)
+					return -EINVAL;
+				break;
+			case INPUT_ABS_FILTER_DEADBAND:
+				if (stage->param[1] < 0)
+					return -EINVAL;
+				break;
+			case INPUT_ABS_FILTER_ONE_EURO:
+				if (stage->param[0] <= 0 || stage->param[1] < 0 || stage->param[2] < 0)
+					return -EINVAL;
+				break;
+			default:
+				return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Give @f->axis of @dev the pipeline @f, or take it away with
+ * f->nstages == 0. For drivers, which know their sensors' noise, to
+ * call once the device is registered, and for EVIOCSABSFILTER.
+ */
+int input_set_abs_filter(struct input_dev *dev, const struct input_abs_filter *f)
+{
+	struct input_abs_pipe *pipe, *old;
+	struct input_dev_state *st;
+	unsigned long flags;
+	int err;
+
+	if ((err = input_check_abs_filter(dev, f)))
+		return err;
+
+	rcu_read_lock();
+	st = input_dev_state(dev);
+	rcu_read_unlock();
+	if (!st)
+		return -ENOMEM;		/* Never got its state */
+
+	pipe = NULL;
+	if (f->nstages) {
+		if (!(pipe = kmalloc(sizeof(struct input_abs_pipe), GFP_KERNEL)))
+			return -ENOMEM;
+		memset(pipe, 0, sizeof(struct input_abs_pipe));
+		pipe->cfg = *f;
+	}
+
+	spin_lock_irqsave(&st->lock, flags);
+	old = st->abs_pipe[f->axis];
+	st->abs_pipe[f->axis] = pipe;
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	kfree(old);
+	return 0;
+}
+
+/* Read back the pipeline of @f->axis; nstages == 0 if it has none */
+int input_get_abs_filter(struct input_dev *dev, struct input_abs_filter *f)
+{
+	struct input_abs_pipe *pipe;
+	struct input_dev_state *st;
+	unsigned long flags;
+
+	if (f->axis > ABS_MAX)
+		return -EINVAL;
+
+	rcu_read_lock();
+	st = input_dev_state(dev);
+	rcu_read_unlock();
+	if (!st)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&st->lock, flags);
+	pipe = st->abs_pipe[f->axis];
+	if (pipe)
+		*f = pipe->cfg;
+	else
+		f->nstages = 0;
+	spin_unlock_irqrestore(&st->lock, flags);
+	return 0;
+}
+
+/*
+ * Pass the buffered frame on. Called with st->lock held, which is
+ * dropped around the handlers since they may feed events back into
+ * the device. One CPU at a time passes frames on, from the spare
+ * buffer, so they arrive in order; a frame completed meanwhile stays
+ * in vals[cur] with ->complete set and the passer picks it up next.
+ */
+static void input_flush_frame(struct input_dev_state *st, unsigned long *flags)
+{
+	struct input_value *vals;
+	unsigned int count;
+
+	st->complete = 1;
+	if (st->passing)
+		return;
+
+	st->passing = 1;
+	st->passer = smp_processor_id();
+	while (st->complete) {
+		vals = st->vals[st->cur];
+		count = st->count;
+		st->cur ^= 1;
+		st->count = 0;
+		st->complete = 0;
+		if (!count)
+			continue;
+		spin_unlock_irqrestore(&st->lock, *flags);
+		input_pass_values(st->dev, vals, count);
+		spin_lock_irqsave(&st->lock, *flags);
+	}
+	st->passing = 0;
+}
+
+/*
+ * Wait for another CPU to finish passing a frame on, so that nothing we
+ * pass next can overtake it. Called and returns with st->lock held.
+ * Returns nonzero if the passer is this CPU: we interrupted it, or one
+ * of its handlers fed an event back into the device, and what we have
+ * goes out nested inside its delivery, as it always did.
+ */
+static int input_wait_passer(struct input_dev_state *st, unsigned long *flags)
+{
+	while (st->passing && st->passer != smp_processor_id()) {
+		spin_unlock_irqrestore(&st->lock, *flags);
+		cpu_relax();
+		spin_lock_irqsave(&st->lock, *flags);
+	}
+	return st->passing;
+}
+
 #ifdef CONFIG_PROC_FS
 static struct proc_dir_entry *proc_bus_input_dir;
 static DECLARE_WAIT_QUEUE_HEAD(input_devices_poll_wait);
@@ -56,10 +777,15 @@ static int input_devices_state;
 
 void input_event(struct input_dev *dev, unsigned int type, unsigned int code, int value)
 {
-	struct input_handle *handle;
+	struct input_dev_state *st;
+	struct input_value v;
+	unsigned long flags;
+
+	rcu_read_lock();
+	st = input_dev_state(dev);
 
 	if (type > EV_MAX || !test_bit(type, dev->evbit))
-		return;
+		goto filtered;
 
 	add_input_randomness(type, code, value);
 
@@ -72,8 +798,10 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 					break;
 
 				case SYN_REPORT:
-					if (dev->sync) return;
+					if (dev->sync) goto filtered;
 					dev->sync = 1;
+					if (st)
+						st->synced = 1;
 					break;
 			}
 			break;
@@ -81,7 +809,7 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 		case EV_KEY:
 
 			if (code > KEY_MAX || !test_bit(code, dev->keybit) || !!test_bit(code, dev->key) == value)
-				return;
+				goto filtered;
 
 			if (value == 2)
 				break;
@@ -90,7 +818,10 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 
 			if (test_bit(EV_REP, dev->evbit) && dev->rep[REP_PERIOD] && dev->rep[REP_DELAY] && dev->timer.data && value) {
 				dev->repeat_key = code;
-				mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->rep[REP_DELAY]));
+				if (st)
+					input_repeat_start(st);
+				else
+					mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->rep[REP_DELAY]));
 			}
 
 			break;
@@ -98,39 +829,21 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 		case EV_ABS:
 
 			if (code > ABS_MAX || !test_bit(code, dev->absbit))
-				return;
+				goto filtered;
 
-			if (dev->absfuzz[code]) {
-				if ((value > dev->abs[code] - (dev->absfuzz[code] >> 1)) &&
-				    (value < dev->abs[code] + (dev->absfuzz[code] >> 1)))
-					return;
-
-				if ((value > dev->abs[code] - dev->absfuzz[code]) &&
-				    (value < dev->abs[code] + dev->absfuzz[code]))
-					value = (dev->abs[code] * 3 + value) >> 2;
-
-				if ((value > dev->abs[code] - (dev->absfuzz[code] << 1)) &&
-				    (value < dev->abs[code] + (dev->absfuzz[code] << 1)))
-					value = (dev->abs[code] + value) >> 1;
-			}
-
-			if (dev->abs[code] == value)
-				return;
-
-			dev->abs[code] = value;
-			break;
+			break;		/* Filtered below */
 
 		case EV_REL:
 
 			if (code > REL_MAX || !test_bit(code, dev->relbit) || (value == 0))
-				return;
+				goto filtered;
 
 			break;
 
 		case EV_MSC:
 
 			if (code > MSC_MAX || !test_bit(code, dev->mscbit))
-				return;
+				goto filtered;
 
 			if (dev->event) dev->event(dev, type, code, value);
 
@@ -139,7 +852,7 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 		case EV_LED:
 
 			if (code > LED_MAX || !test_bit(code, dev->ledbit) || !!test_bit(code, dev->led) == value)
-				return;
+				goto filtered;
 
 			change_bit(code, dev->led);
 			if (dev->event) dev->event(dev, type, code, value);
@@ -149,7 +862,7 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 		case EV_SND:
 
 			if (code > SND_MAX || !test_bit(code, dev->sndbit))
-				return;
+				goto filtered;
 
 			if (dev->event) dev->event(dev, type, code, value);
 
@@ -157,7 +870,7 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 
 		case EV_REP:
 
-			if (code > REP_MAX || value < 0 || dev->rep[code] == value) return;
+			if (code > REP_MAX || value < 0 || dev->rep[code] == value) goto filtered;
 
 			dev->rep[code] = value;
 			if (dev->event) dev->event(dev, type, code, value);
@@ -169,17 +882,67 @@ void input_event(struct input_dev *dev, unsigned int type, unsigned int code, in
 			break;
 	}
 
+	v.type = type;
+	v.code = code;
+	v.value = value;
+
+	if (!st) {
+		if (type == EV_ABS && !input_fuzz_abs(dev, &v))
+			goto filtered;
+		if (type != EV_SYN)
+			dev->sync = 0;
+		input_pass_values(dev, &v, 1);
+		rcu_read_unlock();
+		return;
+	}
+
+	spin_lock_irqsave(&st->lock, flags);
+	if (type == EV_ABS && !input_filter_abs(st, &v)) {
+		spin_unlock_irqrestore(&st->lock, flags);
+		goto filtered;
+	}
+
 	if (type != EV_SYN)
 		dev->sync = 0;
 
-	if (dev->grab)
-		dev->grab->handler->event(dev->grab, type, code, value);
-	else
-		list_for_each_entry(handle, &dev->h_list, d_node)
-			if (handle->open)
-				handle->handler->event(handle, type, code, value);
+	per_cpu_ptr(st->stats, smp_processor_id())->events[type]++;
+	if (type == EV_SYN && code == SYN_REPORT)
+		input_count_frame(st);
+
+	if (input_frames && st->synced &&
+	    (type == EV_SYN || type == EV_KEY || type == EV_REL ||
+	     type == EV_ABS || type == EV_MSC)) {
+		/* Full, and the previous frame is still being passed on */
+		if (st->count >= INPUT_FRAME_MAX) {
+			if (input_wait_passer(st, &flags)) {
+				spin_unlock_irqrestore(&st->lock, flags);
+				input_pass_values(dev, &v, 1);
+				rcu_read_unlock();
+				return;
+			}
+			input_flush_frame(st, &flags);
+		}
+		st->vals[st->cur][st->count++] = v;
+		if (st->count >= INPUT_FRAME_MAX ||
+		    (type == EV_SYN && code == SYN_REPORT))
+			input_flush_frame(st, &flags);
+		spin_unlock_irqrestore(&st->lock, flags);
+	} else {
+		if (!input_wait_passer(st, &flags) && st->count)
+			input_flush_frame(st, &flags);
+		spin_unlock_irqrestore(&st->lock, flags);
+		input_pass_values(dev, &v, 1);
+	}
+	rcu_read_unlock();
+	return;
+
+filtered:
+	if (st)
+		per_cpu_ptr(st->stats, smp_processor_id())->dropped++;
+	rcu_read_unlock();
 }
 
+/* Per-device repeat timer, for devices the core has no state for */
 static void input_repeat_key(unsigned long data)
 {
 	struct input_dev *dev = (void *) data;
@@ -250,47 +1013,275 @@ static void input_link_handle(struct input_handle *handle)
 #define MATCH_BIT(bit, max) \
 		for (i = 0; i < NBITS(max); i++) \
 			if ((id->bit[i] & dev->bit[i]) != id->bit[i]) \
-				break; \
-		if (i != NBITS(max)) \
-			continue;
+				return 0;
+
+static int input_match_id(struct input_device_id *id, struct input_dev *dev)
+{
+	int i;
+
+	if (id->flags & INPUT_DEVICE_ID_MATCH_BUS)
+		if (id->id.bustype != dev->id.bustype)
+			return 0;
+
+	if (id->flags & INPUT_DEVICE_ID_MATCH_VENDOR)
+		if (id->id.vendor != dev->id.vendor)
+			return 0;
+
+	if (id->flags & INPUT_DEVICE_ID_MATCH_PRODUCT)
+		if (id->id.product != dev->id.product)
+			return 0;
+
+	if (id->flags & INPUT_DEVICE_ID_MATCH_VERSION)
+		if (id->id.version != dev->id.version)
+			return 0;
+
+	MATCH_BIT(evbit,  EV_MAX);
+	MATCH_BIT(keybit, KEY_MAX);
+	MATCH_BIT(relbit, REL_MAX);
+	MATCH_BIT(absbit, ABS_MAX);
+	MATCH_BIT(mscbit, MSC_MAX);
+	MATCH_BIT(ledbit, LED_MAX);
+	MATCH_BIT(sndbit, SND_MAX);
+	MATCH_BIT(ffbit,  FF_MAX);
+
+	return 1;
+}
 
 static struct input_device_id *input_match_device(struct input_device_id *id, struct input_dev *dev)
 {
+	for (; id->flags || id->driver_info; id++)
+		if (input_match_id(id, dev))
+			return id;
+
+	return NULL;
+}
+
+/*
+ * Match index. Every id_table and blacklist entry of a registered
+ * handler is compiled into an input_match_entry carrying a one-word
+ * signature of the capability bits it asks for: each bitmap is folded
+ * onto a long and rotated by its own amount. Folding preserves subsets,
+ * so an entry whose signature has a bit the device's lacks can't match
+ * and is skipped without walking the bitmaps. Entries that name a
+ * vendor are hashed on it and the rest sit on one list, so a new device
+ * only looks at entries that could apply to it.
+ */
+
+#define INPUT_MATCH_HASH_BITS	6
+
+struct input_match_entry {
+	struct hlist_node node;
+	struct input_handler_state *hs;
+	struct input_device_id *id;
+	unsigned long sig;
+	unsigned int index;		/* Position in its table */
+	int black;			/* From the blacklist */
+};
+
+static struct hlist_head input_match_hash[1 << INPUT_MATCH_HASH_BITS];
+static HLIST_HEAD(input_match_any);
+static int input_unindexed;		/* Handlers we failed to index */
+static unsigned int input_match_gen;
+static unsigned int input_handler_seq;
+
+#define SIG_BIT(bit, max, rot) \
+	do { \
+		unsigned long w = 0; \
+		for (i = 0; i < NBITS(max); i++) \
+			w |= p->bit[i]; \
+		sig |= (w << rot) | (w >> (BITS_PER_LONG - rot)); \
+	} while (0)
+
+#define SIG_BITS \
+	do { \
+		SIG_BIT(evbit,  EV_MAX,  3); \
+		SIG_BIT(keybit, KEY_MAX, 7); \
+		SIG_BIT(relbit, REL_MAX, 11); \
+		SIG_BIT(absbit, ABS_MAX, 15); \
+		SIG_BIT(mscbit, MSC_MAX, 19); \
+		SIG_BIT(ledbit, LED_MAX, 23); \
+		SIG_BIT(sndbit, SND_MAX, 27); \
+		SIG_BIT(ffbit,  FF_MAX,  31); \
+	} while (0)
+
+static unsigned long input_dev_sig(struct input_dev *p)
+{
+	unsigned long sig = 0;
 	int i;
 
-	for (; id->flags || id->driver_info; id++) {
+	SIG_BITS;
+	return sig;
+}
 
-		if (id->flags & INPUT_DEVICE_ID_MATCH_BUS)
-			if (id->id.bustype != dev->id.bustype)
-				continue;
+static unsigned long input_id_sig(struct input_device_id *p)
+{
+	unsigned long sig = 0;
+	int i;
 
-		if (id->flags & INPUT_DEVICE_ID_MATCH_VENDOR)
-			if (id->id.vendor != dev->id.vendor)
-				continue;
+	SIG_BITS;
+	return sig;
+}
 
-		if (id->flags & INPUT_DEVICE_ID_MATCH_PRODUCT)
-			if (id->id.product != dev->id.product)
-				continue;
+static inline struct hlist_head *input_match_head(__u16 vendor)
+{
+	return &input_match_hash[hash_long(vendor, INPUT_MATCH_HASH_BITS)];
+}
 
-		if (id->flags & INPUT_DEVICE_ID_MATCH_VERSION)
-			if (id->id.version != dev->id.version)
-				continue;
+static unsigned int input_table_len(struct input_device_id *id)
+{
+	unsigned int n = 0;
+
+	if (id)
+		for (; id->flags || id->driver_info; id++)
+			n++;
+	return n;
+}
+
+static void input_index_add(struct input_match_entry *e, struct input_handler_state *hs,
+			    struct input_device_id *id, unsigned int index, int black)
+{
+	e->hs = hs;
+	e->id = id;
+	e->sig = input_id_sig(id);
+	e->index = index;
+	e->black = black;
+
+	if (id->flags & INPUT_DEVICE_ID_MATCH_VENDOR)
+		hlist_add_head(&e->node, input_match_head(id->id.vendor));
+	else
+		hlist_add_head(&e->node, &input_match_any);
+}
+
+static void input_index_handler(struct input_handler *handler)
+{
+	struct input_handler_state *hs = input_handler_state(handler);
+	unsigned int nid = input_table_len(handler->id_table);
+	unsigned int nbl = input_table_len(handler->blacklist);
+	unsigned int i;
+
+	if (!hs || (nid + nbl && !(hs->entries = kmalloc((nid + nbl) * sizeof(struct input_match_entry), GFP_KERNEL)))) {
+		input_unindexed++;
+		return;
+	}
+
+	for (i = 0; i < nid; i++)
+		input_index_add(&hs->entries[i], hs, &handler->id_table[i], i, 0);
+	for (i = 0; i < nbl; i++)
+		input_index_add(&hs->entries[nid + i], hs, &handler->blacklist[i], i, 1);
 
-		MATCH_BIT(evbit,  EV_MAX);
-		MATCH_BIT(keybit, KEY_MAX);
-		MATCH_BIT(relbit, REL_MAX);
-		MATCH_BIT(absbit, ABS_MAX);
-		MATCH_BIT(mscbit, MSC_MAX);
-		MATCH_BIT(ledbit, LED_MAX);
-		MATCH_BIT(sndbit, SND_MAX);
-		MATCH_BIT(ffbit,  FF_MAX);
+	hs->nentries = nid + nbl;
+	hs->seq = input_handler_seq++;
+	hs->indexed = 1;
+}
+
+static void input_unindex_handler(struct input_handler *handler)
+{
+	struct input_handler_state *hs = input_find_handler_state(handler);
+	unsigned int i;
+
+	if (!hs || !hs->indexed) {
+		input_unindexed--;
+		return;
+	}
+
+	for (i = 0; i < hs->nentries; i++)
+		hlist_del(&hs->entries[i].node);
+	kfree(hs->entries);
+	hs->entries = NULL;
+	hs->nentries = 0;
+	hs->indexed = 0;
+}
 
-		return id;
+/*
+ * What input_match_device() on the blacklist and then the id_table
+ * would give, using the compiled entries.
+ */
+static struct input_device_id *input_match_handler(struct input_handler *handler, struct input_dev *dev)
+{
+	struct input_handler_state *hs = input_find_handler_state(handler);
+	struct input_match_entry *e;
+	unsigned long sig;
+	unsigned int i;
+
+	if (!hs || !hs->indexed) {
+		if (handler->blacklist && input_match_device(handler->blacklist, dev))
+			return NULL;
+		return input_match_device(handler->id_table, dev);
+	}
+
+	sig = input_dev_sig(dev);
+
+	/* Blacklist entries come last in the array */
+	for (i = hs->nentries; i-- > 0; ) {
+		e = &hs->entries[i];
+		if (!e->black)
+			break;
+		if (!(e->sig & ~sig) && input_match_id(e->id, dev))
+			return NULL;
+	}
+
+	for (i = 0; i < hs->nentries && !hs->entries[i].black; i++) {
+		e = &hs->entries[i];
+		if (!(e->sig & ~sig) && input_match_id(e->id, dev))
+			return e->id;
 	}
 
 	return NULL;
 }
 
+static void input_match_entries(struct hlist_head *head, struct input_dev *dev,
+				unsigned long sig, struct list_head *matched)
+{
+	struct input_match_entry *e;
+	struct input_handler_state *hs, *pos;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(e, n, head, node) {
+
+		if ((e->sig & ~sig) || !input_match_id(e->id, dev))
+			continue;
+
+		hs = e->hs;
+		if (hs->gen != input_match_gen) {
+			hs->gen = input_match_gen;
+			hs->best = NULL;
+			hs->blocked = 0;
+			/* Connect in handler registration order */
+			list_for_each_entry(pos, matched, match_node)
+				if (pos->seq > hs->seq)
+					break;
+			list_add_tail(&hs->match_node, &pos->match_node);
+		}
+
+		if (e->black)
+			hs->blocked = 1;
+		else if (!hs->best || e->index < hs->best_index) {
+			hs->best = e->id;
+			hs->best_index = e->index;
+		}
+	}
+}
+
+static void input_connect_indexed(struct input_dev *dev)
+{
+	struct input_handler_state *hs, *next;
+	struct input_handle *handle;
+	unsigned long sig = input_dev_sig(dev);
+	LIST_HEAD(matched);
+
+	input_match_gen++;
+	input_match_entries(input_match_head(dev->id.vendor), dev, sig, &matched);
+	input_match_entries(&input_match_any, dev, sig, &matched);
+
+	list_for_each_entry_safe(hs, next, &matched, match_node) {
+		list_del(&hs->match_node);
+		if (hs->blocked || !hs->best)
+			continue;
+		if ((handle = hs->handler->connect(hs->handler, dev, hs->best)))
+			input_link_handle(handle);
+	}
+}
+
 /*
  * Input hotplugging interface - loading event handlers based on
  * device bitfields.
@@ -429,11 +1420,14 @@ void input_register_device(struct input_dev *dev)
 	}
 
 	INIT_LIST_HEAD(&dev->h_list);
+	input_attach_state(dev);
 	list_add_tail(&dev->node, &input_dev_list);
 
-	list_for_each_entry(handler, &input_handler_list, node)
-		if (!handler->blacklist || !input_match_device(handler->blacklist, dev))
-			if ((id = input_match_device(handler->id_table, dev)))
+	if (!input_unindexed)
+		input_connect_indexed(dev);
+	else
+		list_for_each_entry(handler, &input_handler_list, node)
+			if ((id = input_match_handler(handler, dev)))
 				if ((handle = handler->connect(handler, dev, id)))
 					input_link_handle(handle);
 
@@ -467,6 +1461,7 @@ void input_unregister_device(struct input_dev *dev)
 #endif
 
 	list_del_init(&dev->node);
+	input_detach_state(dev);
 
 #ifdef CONFIG_PROC_FS
 	input_devices_state++;
@@ -488,12 +1483,12 @@ void input_register_handler(struct input_handler *handler)
 		input_table[handler->minor >> 5] = handler;
 
 	list_add_tail(&handler->node, &input_handler_list);
+	input_index_handler(handler);
 
 	list_for_each_entry(dev, &input_dev_list, node)
-		if (!handler->blacklist || !input_match_device(handler->blacklist, dev))
-			if ((id = input_match_device(handler->id_table, dev)))
-				if ((handle = handler->connect(handler, dev, id)))
-					input_link_handle(handle);
+		if ((id = input_match_handler(handler, dev)))
+			if ((handle = handler->connect(handler, dev, id)))
+				input_link_handle(handle);
 
 #ifdef CONFIG_PROC_FS
 	input_devices_state++;
@@ -513,6 +1508,8 @@ void input_unregister_handler(struct input_handler *handler)
 	}
 
 	list_del_init(&handler->node);
+	input_unindex_handler(handler);
+	input_free_handler_state(handler);
 
 	if (handler->fops != NULL)
 		input_table[handler->minor >> 5] = NULL;
@@ -674,6 +1671,154 @@ static int input_handlers_read(char *buf, char **start, off_t pos, int count, in
 	return (count > cnt) ? cnt : count;
 }
 
+static const char *input_ev_names[EV_MAX + 1] = {
+	[EV_SYN] = "SYN", [EV_KEY] = "KEY", [EV_REL] = "REL", [EV_ABS] = "ABS",
+	[EV_MSC] = "MSC", [EV_LED] = "LED", [EV_SND] = "SND", [EV_REP] = "REP",
+	[EV_FF] = "FF", [EV_PWR] = "PWR", [EV_FF_STATUS] = "FF_STATUS",
+};
+
+static int input_dev_stats_sprintf(char *buf, struct input_dev *dev)
+{
+	struct input_dev_stats sum;
+	struct input_dev_state *st;
+	int cpu, i, len;
+
+	len = sprintf(buf, "N: Name=\"%s\"\n", dev->name ? dev->name : "");
+
+	rcu_read_lock();
+	if (!(st = input_dev_state(dev))) {
+		rcu_read_unlock();
+		return len + sprintf(buf + len, "\n");
+	}
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_cpu(cpu) {
+		struct input_dev_stats *s = per_cpu_ptr(st->stats, cpu);
+		for (i = 0; i <= EV_MAX; i++)
+			sum.events[i] += s->events[i];
+		sum.dropped += s->dropped;
+		sum.frames += s->frames;
+	}
+
+	len += sprintf(buf + len, "E:");
+	for (i = 0; i <= EV_MAX; i++)
+		if (test_bit(i, dev->evbit)) {
+			if (input_ev_names[i])
+				len += sprintf(buf + len, " %s=%lu", input_ev_names[i], sum.events[i]);
+			else
+				len += sprintf(buf + len, " %d=%lu", i, sum.events[i]);
+		}
+	len += sprintf(buf + len, "\nF: Dropped=%lu Frames=%lu Rate=%u\n\n",
+		sum.dropped, sum.frames,
+		time_before(jiffies, st->window + 2 * HZ) ? st->rate : 0);
+	rcu_read_unlock();
+
+	return len;
+}
+
+static int input_handler_stats_sprintf(char *buf, struct input_handler_state *hs)
+{
+	struct input_handler_lat sum;
+	int cpu, i, len;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_cpu(cpu) {
+		struct input_handler_lat *l = per_cpu_ptr(hs->lat, cpu);
+		sum.calls += l->calls;
+		for (i = 0; i < INPUT_LAT_BUCKETS; i++)
+			sum.hist[i] += l->hist[i];
+	}
+
+	len = sprintf(buf, "H: Name=%s Calls=%lu\nL:", hs->handler->name, sum.calls);
+	for (i = 0; i < INPUT_LAT_BUCKETS; i++)
+		len += sprintf(buf + len, " %lu", sum.hist[i]);
+	return len + sprintf(buf + len, "\n\n");
+}
+
+/*
+ * Devices first, then handlers. L: lines are histograms of the time one
+ * delivery to the handler took, bucket n counting calls under 2^n us and
+ * the last one everything slower.
+ */
+static int input_stats_read(char *buf, char **start, off_t pos, int count, int *eof, void *data)
+{
+	struct input_dev *dev;
+	struct input_handler_state *hs;
+
+	off_t at = 0;
+	int len, cnt = 0;
+
+	list_for_each_entry(dev, &input_dev_list, node) {
+
+		len = input_dev_stats_sprintf(buf, dev);
+		at += len;
+
+		if (at >= pos) {
+			if (!*start) {
+				*start = buf + (pos - (at - len));
+				cnt = at - pos;
+			} else  cnt += len;
+			buf += len;
+			if (cnt >= count)
+				return count;
+		}
+	}
+
+	list_for_each_entry(hs, &input_handler_states, node) {
+
+		len = input_handler_stats_sprintf(buf, hs);
+		at += len;
+
+		if (at >= pos) {
+			if (!*start) {
+				*start = buf + (pos - (at - len));
+				cnt = at - pos;
+			} else  cnt += len;
+			buf += len;
+			if (cnt >= count)
+				break;
+		}
+	}
+	if (&hs->node == &input_handler_states)
+		*eof = 1;
+
+	return (count > cnt) ? cnt : count;
+}
+
+static int input_absfilter_ioctl(struct inode *inode, struct file *file,
+				 unsigned int cmd, unsigned long arg)
+{
+	struct input_abs_filter_req req;
+	struct input_dev *dev;
+	int err;
+
+	if (cmd != EVIOCGABSFILTER && cmd != EVIOCSABSFILTER)
+		return -ENOTTY;
+	if (cmd == EVIOCSABSFILTER && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&req, (void __user *) arg, sizeof(req)))
+		return -EFAULT;
+	req.phys[INPUT_PHYS_LEN - 1] = '\0';
+
+	list_for_each_entry(dev, &input_dev_list, node)
+		if (dev->phys && !strcmp(dev->phys, req.phys))
+			break;
+	if (&dev->node == &input_dev_list)
+		return -ENODEV;
+
+	if (cmd == EVIOCSABSFILTER)
+		return input_set_abs_filter(dev, &req.filter);
+
+	if ((err = input_get_abs_filter(dev, &req.filter)))
+		return err;
+	return copy_to_user((void __user *) arg, &req, sizeof(req)) ? -EFAULT : 0;
+}
+
+static struct file_operations input_absfilter_fops = {
+	.owner = THIS_MODULE,
+	.ioctl = input_absfilter_ioctl,
+};
+
 static int __init input_proc_init(void)
 {
 	struct proc_dir_entry *entry;
@@ -696,6 +1841,24 @@ static int __init input_proc_init(void)
 		return -ENOMEM;
 	}
 	entry->owner = THIS_MODULE;
+	entry = create_proc_read_entry("stats", 0, proc_bus_input_dir, input_stats_read, NULL);
+	if (entry == NULL) {
+		remove_proc_entry("handlers", proc_bus_input_dir);
+		remove_proc_entry("devices", proc_bus_input_dir);
+		remove_proc_entry("input", proc_bus);
+		return -ENOMEM;
+	}
+	entry->owner = THIS_MODULE;
+	entry = create_proc_entry("absfilter", S_IRUGO, proc_bus_input_dir);
+	if (entry == NULL) {
+		remove_proc_entry("stats", proc_bus_input_dir);
+		remove_proc_entry("handlers", proc_bus_input_dir);
+		remove_proc_entry("devices", proc_bus_input_dir);
+		remove_proc_entry("input", proc_bus);
+		return -ENOMEM;
+	}
+	entry->owner = THIS_MODULE;
+	entry->proc_fops = &input_absfilter_fops;
 	return 0;
 }
 
@@ -733,6 +1896,8 @@ static int __init input_init(void)
 		printk(KERN_ERR "input: unable to register char major %d", INPUT_MAJOR);
 		remove_proc_entry("devices", proc_bus_input_dir);
 		remove_proc_entry("handlers", proc_bus_input_dir);
+		remove_proc_entry("stats", proc_bus_input_dir);
+		remove_proc_entry("absfilter", proc_bus_input_dir);
 		remove_proc_entry("input", proc_bus);
 		class_simple_destroy(input_class);
 		return retval;
@@ -742,6 +1907,8 @@ static int __init input_init(void)
 	if (retval) {
 		remove_proc_entry("devices", proc_bus_input_dir);
 		remove_proc_entry("handlers", proc_bus_input_dir);
+		remove_proc_entry("stats", proc_bus_input_dir);
+		remove_proc_entry("absfilter", proc_bus_input_dir);
 		remove_proc_entry("input", proc_bus);
 		unregister_chrdev(INPUT_MAJOR, "input");
 		class_simple_destroy(input_class);
@@ -751,8 +1918,12 @@ static int __init input_init(void)
 
 static void __exit input_exit(void)
 {
+	del_timer_sync(&input_repeat_timer);
+
 	remove_proc_entry("devices", proc_bus_input_dir);
 	remove_proc_entry("handlers", proc_bus_input_dir);
+	remove_proc_entry("stats", proc_bus_input_dir);
+	remove_proc_entry("absfilter", proc_bus_input_dir);
 	remove_proc_entry("input", proc_bus);
 
 	devfs_remove("input");
@@ -47,6 +47,8 @@
 #include <linux/devfs_fs.h>
 #include <linux/tty.h>
 #include <linux/vt_kern.h>
+#include <linux/kbmap.h>
+#include <linux/vcs.h>
 #include <linux/fb.h>
 #include <linux/ext2_fs.h>
 #include <linux/videodev.h>
@@ -1693,30 +1695,29 @@ struct atm_iobuf32 {
 #define ATM_SETLOOP32	  _IOW('a', ATMIOC_SARCOM+3, struct atmif_sioc32)
 #define ATM_QUERYLOOP32	  _IOW('a', ATMIOC_SARCOM+4, struct atmif_sioc32)
 
-static struct {
-        unsigned int cmd32;
-        unsigned int cmd;
-} atm_ioctl_map[] = {
-        { ATM_GETLINKRATE32, ATM_GETLINKRATE },
-	{ ATM_GETNAMES32,    ATM_GETNAMES },
-        { ATM_GETTYPE32,     ATM_GETTYPE },
-        { ATM_GETESI32,      ATM_GETESI },
-        { ATM_GETADDR32,     ATM_GETADDR },
-        { ATM_RSTADDR32,     ATM_RSTADDR },
-        { ATM_ADDADDR32,     ATM_ADDADDR },
-        { ATM_DELADDR32,     ATM_DELADDR },
-        { ATM_GETCIRANGE32,  ATM_GETCIRANGE },
-	{ ATM_SETCIRANGE32,  ATM_SETCIRANGE },
-	{ ATM_SETESI32,      ATM_SETESI },
-	{ ATM_SETESIF32,     ATM_SETESIF },
-	{ ATM_GETSTAT32,     ATM_GETSTAT },
-	{ ATM_GETSTATZ32,    ATM_GETSTATZ },
-	{ ATM_GETLOOP32,     ATM_GETLOOP },
-	{ ATM_SETLOOP32,     ATM_SETLOOP },
-	{ ATM_QUERYLOOP32,   ATM_QUERYLOOP }
-};
-
-#define NR_ATM_IOCTL (sizeof(atm_ioctl_map)/sizeof(atm_ioctl_map[0]))
+static inline unsigned int atm_ioctl_kcmd(unsigned int cmd32)
+{
+	switch (cmd32) {
+	case ATM_GETLINKRATE32:	return ATM_GETLINKRATE;
+	case ATM_GETNAMES32:	return ATM_GETNAMES;
+	case ATM_GETTYPE32:	return ATM_GETTYPE;
+	case ATM_GETESI32:	return ATM_GETESI;
+	case ATM_GETADDR32:	return ATM_GETADDR;
+	case ATM_RSTADDR32:	return ATM_RSTADDR;
+	case ATM_ADDADDR32:	return ATM_ADDADDR;
+	case ATM_DELADDR32:	return ATM_DELADDR;
+	case ATM_GETCIRANGE32:	return ATM_GETCIRANGE;
+	case ATM_SETCIRANGE32:	return ATM_SETCIRANGE;
+	case ATM_SETESI32:	return ATM_SETESI;
+	case ATM_SETESIF32:	return ATM_SETESIF;
+	case ATM_GETSTAT32:	return ATM_GETSTAT;
+	case ATM_GETSTATZ32:	return ATM_GETSTATZ;
+	case ATM_GETLOOP32:	return ATM_GETLOOP;
+	case ATM_SETLOOP32:	return ATM_SETLOOP;
+	case ATM_QUERYLOOP32:	return ATM_QUERYLOOP;
+	}
+	return 0;
+}
 
 
 static int do_atm_iobuf(unsigned int fd, unsigned int cmd, unsigned long arg)
@@ -1779,8 +1780,7 @@ static int do_atmif_sioc(unsigned int fd, unsigned int cmd, unsigned long arg)
 
 static int do_atm_ioctl(unsigned int fd, unsigned int cmd32, unsigned long arg)
 {
-        int i;
-        unsigned int cmd = 0;
+        unsigned int cmd;
         
 	switch (cmd32) {
 	case SONET_GETSTAT:
@@ -1794,13 +1794,8 @@ static int do_atm_ioctl(unsigned int fd, unsigned int cmd32, unsigned long arg)
 		return do_atmif_sioc(fd, cmd32, arg);
 	}
 
-	for (i = 0; i < NR_ATM_IOCTL; i++) {
-		if (cmd32 == atm_ioctl_map[i].cmd32) {
-			cmd = atm_ioctl_map[i].cmd;
-			break;
-		}
-	}
-	if (i == NR_ATM_IOCTL)
+	cmd = atm_ioctl_kcmd(cmd32);
+	if (!cmd)
 	        return -EINVAL;
         
         switch (cmd) {
@@ -2003,35 +1998,35 @@ struct floppy_write_errors32 {
 #define FDGETFDCSTAT32 _IOR(2, 0x15, struct floppy_fdc_state32)
 #define FDWERRORGET32  _IOR(2, 0x17, struct floppy_write_errors32)
 
-static struct {
-	unsigned int	cmd32;
-	unsigned int	cmd;
-} fd_ioctl_trans_table[] = {
-	{ FDSETPRM32, FDSETPRM },
-	{ FDDEFPRM32, FDDEFPRM },
-	{ FDGETPRM32, FDGETPRM },
-	{ FDSETDRVPRM32, FDSETDRVPRM },
-	{ FDGETDRVPRM32, FDGETDRVPRM },
-	{ FDGETDRVSTAT32, FDGETDRVSTAT },
-	{ FDPOLLDRVSTAT32, FDPOLLDRVSTAT },
-	{ FDGETFDCSTAT32, FDGETFDCSTAT },
-	{ FDWERRORGET32, FDWERRORGET }
-};
-
-#define NR_FD_IOCTL_TRANS (sizeof(fd_ioctl_trans_table)/sizeof(fd_ioctl_trans_table[0]))
+/*
+ * The 32->64 bit command maps are switches rather than tables, so the
+ * compiler turns them into a jump table or a compare tree instead of
+ * us walking an array on every call.
+ */
+static inline unsigned int fd_ioctl_kcmd(unsigned int cmd32)
+{
+	switch (cmd32) {
+	case FDSETPRM32:	return FDSETPRM;
+	case FDDEFPRM32:	return FDDEFPRM;
+	case FDGETPRM32:	return FDGETPRM;
+	case FDSETDRVPRM32:	return FDSETDRVPRM;
+	case FDGETDRVPRM32:	return FDGETDRVPRM;
+	case FDGETDRVSTAT32:	return FDGETDRVSTAT;
+	case FDPOLLDRVSTAT32:	return FDPOLLDRVSTAT;
+	case FDGETFDCSTAT32:	return FDGETFDCSTAT;
+	case FDWERRORGET32:	return FDWERRORGET;
+	}
+	return 0;
+}
 
 static int fd_ioctl_trans(unsigned int fd, unsigned int cmd, unsigned long arg)
 {
 	mm_segment_t old_fs = get_fs();
 	void *karg = NULL;
-	unsigned int kcmd = 0;
-	int i, err;
+	unsigned int kcmd;
+	int err;
 
-	for (i = 0; i < NR_FD_IOCTL_TRANS; i++)
-		if (cmd == fd_ioctl_trans_table[i].cmd32) {
-			kcmd = fd_ioctl_trans_table[i].cmd;
-			break;
-		}
+	kcmd = fd_ioctl_kcmd(cmd);
 	if (!kcmd)
 		return -EINVAL;
 
@@ -2991,6 +2986,9 @@ HANDLE_IOCTL(GIO_FONTX, do_fontx_ioctl)
 HANDLE_IOCTL(PIO_UNIMAP, do_unimap_ioctl)
 HANDLE_IOCTL(GIO_UNIMAP, do_unimap_ioctl)
 HANDLE_IOCTL(KDFONTOP, do_kdfontop_ioctl)
+COMPATIBLE_IOCTL(KDSKBMAPS)
+/* struct vcs_delta is laid out the same for 32 and 64 bit */
+COMPATIBLE_IOCTL(VCS_GETDELTA)
 #endif
 HANDLE_IOCTL(EXT2_IOC32_GETFLAGS, do_ext2_ioctl)
 HANDLE_IOCTL(EXT2_IOC32_SETFLAGS, do_ext2_ioctl)
@@ -11,5 +11,6 @@
 struct vc_data;
 
 extern unsigned char inverse_translate(struct vc_data *vc, int glyph);
+extern u16 inverse_translate_unicode(struct vc_data *vc, int glyph);
 extern void set_translate(struct vc_data *vc, int m);
 extern int conv_uni_to_pc(struct vc_data *vc, long ucs);
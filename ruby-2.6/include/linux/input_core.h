@@ -0,0 +1,90 @@
+#ifndef _INPUT_CORE_H
+#define _INPUT_CORE_H
+
+/*
+ * Input core interfaces beyond <linux/input.h>. State the core keeps
+ * per device lives in input.c and is looked up by device, so neither
+ * struct input_dev nor struct input_handler need to grow.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#include <linux/input.h>
+
+/*
+ * One event as buffered by the core. Events are collected per device
+ * until SYN_REPORT and then handed to the handlers as one frame.
+ */
+struct input_value {
+	__u16 type;
+	__u16 code;
+	__s32 value;
+};
+
+typedef void (*input_events_t)(struct input_handle *handle,
+			       const struct input_value *vals,
+			       unsigned int count);
+
+/*
+ * Handlers that can take a whole frame at once register an events()
+ * callback next to their ->event; handlers without one keep getting
+ * the events one by one through ->event.
+ */
+int input_set_events_handler(struct input_handler *handler, input_events_t events);
+
+/*
+ * Per-axis ABS filter pipelines. When an axis has one, the core's
+ * built-in absfuzz smoothing is skipped for it and the stages run in
+ * order over each frame instead; a stage can drop the value. Stage
+ * parameters:
+ *
+ *	FUZZ		param[0] fuzz, 0 for the device's absfuzz
+ *	EMA		param[0] weight of a new sample in 1/256, 1..256
+ *	DEADBAND	param[0] centre, param[1] half width
+ *	ONE_EURO	param[0] min cutoff (mHz), param[1] beta (mHz per
+ *			unit/s), param[2] derivative cutoff (mHz, 0 for 1 Hz)
+ *
+ * nstages == 0 puts the axis back on the built-in filter.
+ */
+#define INPUT_ABS_FILTER_FUZZ		1
+#define INPUT_ABS_FILTER_EMA		2
+#define INPUT_ABS_FILTER_DEADBAND	3
+#define INPUT_ABS_FILTER_ONE_EURO	4
+
+#define INPUT_ABS_FILTER_STAGES		4
+
+struct input_abs_stage {
+	__u16 type;
+	__u16 reserved;
+	__s32 param[3];
+};
+
+struct input_abs_filter {
+	__u16 axis;
+	__u16 nstages;
+	struct input_abs_stage stage[INPUT_ABS_FILTER_STAGES];
+};
+
+int input_set_abs_filter(struct input_dev *dev, const struct input_abs_filter *f);
+int input_get_abs_filter(struct input_dev *dev, struct input_abs_filter *f);
+
+/*
+ * From user space the pipelines are read and set with these ioctls on
+ * /proc/bus/input/absfilter. The device is named by its Phys= string
+ * as listed in /proc/bus/input/devices; setting needs CAP_SYS_ADMIN.
+ */
+#define INPUT_PHYS_LEN		64
+
+struct input_abs_filter_req {
+	char phys[INPUT_PHYS_LEN];
+	struct input_abs_filter filter;
+};
+
+#define EVIOCGABSFILTER		_IOWR('E', 0xa0, struct input_abs_filter_req)
+#define EVIOCSABSFILTER		_IOW('E', 0xa1, struct input_abs_filter_req)
+
+#endif
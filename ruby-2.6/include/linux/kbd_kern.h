@@ -9,7 +9,29 @@
 
 extern struct tasklet_struct keyboard_tasklet;
 
-extern int shift_state;
+#define KBD_STAGE_SIZE	256
+
+/*
+ * Keyboard state of one seat, kept in its struct vt_struct. Keys held
+ * or dead keys pending on one display's keyboard don't affect another's,
+ * and seats never touch each other's state.
+ */
+struct kbd_seat {
+	unsigned long key_down[NBITS(KEY_MAX)];	/* keyboard key bitmap */
+	unsigned char shift_down[NR_SHIFT];	/* shift state counters.. */
+	int shift_state;
+	int dead_key_next;
+	int npadch;				/* -1 or number assembled on pad */
+	unsigned char diacr;
+	char rep;				/* flag telling character repeat */
+	char sysrq_down;
+	char sysrq_alt;
+
+	/* Output gathered during an input frame, see put_queue() */
+	struct tty_struct *stage_tty;
+	unsigned int stage_count;
+	unsigned char stage[KBD_STAGE_SIZE];
+};
 
 extern char *func_table[MAX_NR_FUNC];
 extern char func_buf[];
@@ -88,8 +110,6 @@ extern int kbd_init(void);
 extern unsigned char getledstate(struct vc_data *vc);
 extern void setledstate(struct vc_data *vc, unsigned int led);
 
-extern int do_poke_blanked_console;
-
 extern void (*kbd_ledfunc) (unsigned int led);
 
 static inline void set_leds(void)
@@ -151,6 +171,7 @@ static inline void chg_kbd_led(struct kbd_struct * kbd, int flag)
 
 /* keyboard.c */
 struct vc_data;
+struct vt_struct;
 
 int getkeycode(struct input_handle *handle, unsigned int scancode);
 int setkeycode(struct input_handle *handle, unsigned int scancode, unsigned int keycode);
@@ -158,7 +179,9 @@ void kd_mksound(struct input_handle *handle, unsigned int hz, unsigned int ticks
 void kd_nosound(unsigned long private);
 int kbd_rate(struct input_handle *handle, struct kbd_repeat *rep);
 void puts_queue(struct vc_data *vc, char *cp);
-void compute_shiftstate(void);
+void compute_shiftstate(struct vt_struct *vt);
+void kbd_seat_init(struct kbd_seat *kbd);
+void kbd_keymap_changed(int table, int index);
 
 /* defkeymap.c */
 
@@ -0,0 +1,34 @@
+/*
+ * kbmap.h
+ *
+ * Loading whole keymaps in one ioctl instead of one KDSKBENT per key.
+ */
+
+#ifndef _LINUX_KBMAP_H_
+#define _LINUX_KBMAP_H_
+
+#include <linux/types.h>
+#include <linux/keyboard.h>
+
+/*
+ * KDSKBMAPS: arg points to a struct kbmaps followed by kb_count
+ * struct kbmap. Each entry replaces keymap kb_table as a whole; one
+ * with kb_values[0] == K_NOSUCHMAP frees it instead (not map 0). All
+ * entries are checked before any map is touched, so on error nothing
+ * changes, and the keyboard sees the new maps all at once. Entry 0
+ * of each map is ignored otherwise, as with KDSKBENT.
+ */
+struct kbmap {
+	__u8 kb_table;
+	__u8 kb_pad;
+	__u16 kb_values[NR_KEYS];
+};
+
+struct kbmaps {
+	__u32 kb_count;
+	struct kbmap kb_maps[0];
+};
+
+#define KDSKBMAPS	0x4B7A
+
+#endif
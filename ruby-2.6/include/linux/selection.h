@@ -10,9 +10,12 @@
 #include <linux/tiocl.h>
 #include <linux/vt_buffer.h>
 
+struct vt_struct;
+
 extern struct vc_data *sel_cons;
 
 extern void clear_selection(void);
+extern void clear_selection_on(struct vt_struct *vt);
 extern int set_selection(const struct tiocl_selection __user *sel, struct tty_struct *tty);
 extern int paste_selection(struct tty_struct *tty);
 extern int sel_loadlut(char __user *p);
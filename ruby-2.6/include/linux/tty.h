@@ -104,15 +104,49 @@ extern struct screen_info screen_info;
 #define __DISABLED_CHAR '\0'
 
 /*
- * This is the flip buffer used for the tty driver.  The buffer is
- * located in the tty structure, and is used as a high speed interface
- * between the tty driver and the tty line discipline.
+ * This is the flip buffer used for the tty driver, the high speed
+ * interface between the tty driver and the tty line discipline.
+ *
+ * Received characters are queued on a chain of tty_buffers. The driver
+ * fills the tail and publishes what it wrote by advancing ->commit;
+ * flush_to_ldisc() consumes from the head and recycles drained buffers
+ * into a small per-tty pool. The consumer takes no lock. Producers take
+ * ->lock (which also covers the pool) in tty_insert_flip_string() and
+ * tty_insert_flip_flag(), so a tty may be fed from several contexts;
+ * a driver filling the tail itself after tty_buffer_request_room()
+ * must be the only producer.
+ *
+ * The classic two half buffers are kept for drivers that still use
+ * tty_insert_flip_char() and the char_buf_ptr/flag_buf_ptr/count
+ * fields directly. flush_to_ldisc() drains them before the chain.
  */
-#define TTY_FLIPBUF_SIZE 512
+#define TTY_FLIPBUF_SIZE	512	/* Standard (pooled) buffer */
+#define TTY_BUFFER_MAX		4096	/* Largest single buffer */
+#define TTY_BUFFER_LIMIT	65536	/* Most a tty may have queued */
+#define TTY_BUFFER_POOL		4	/* Spare buffers kept per tty */
+
+struct tty_buffer {
+	struct tty_buffer *next;
+	int		size;
+	int		used;		/* Producer's fill mark */
+	int		commit;		/* What the consumer may read */
+	int		read;		/* Consumer's read mark */
+	unsigned char	*char_buf;
+	char		*flag_buf;
+	unsigned long	data[0];
+};
 
 struct tty_flip_buffer {
 	struct work_struct		work;
 	struct semaphore pty_sem;
+	struct tty_buffer *head;	/* Consumer end */
+	struct tty_buffer *tail;	/* Producer end */
+	struct tty_buffer *free;	/* Spare TTY_FLIPBUF_SIZE buffers */
+	int		nfree;
+	atomic_t	memory_used;
+	unsigned long	dropped;	/* Characters refused at the limit */
+	spinlock_t	lock;
+	/* Old style flip buffer */
 	char		*char_buf_ptr;
 	unsigned char	*flag_buf_ptr;
 	int		count;
@@ -122,7 +156,7 @@ struct tty_flip_buffer {
 	unsigned char	slop[4]; /* N.B. bug overwrites buffer by 1 */
 };
 /*
- * The pty uses char_buf and flag_buf as a contiguous buffer
+ * The pty pushes at most this much through the flip buffer at a time
  */
 #define PTY_BUF_SIZE	4*TTY_FLIPBUF_SIZE
 
@@ -234,6 +268,7 @@ struct tty_struct {
 	struct tty_driver *driver;
 	int index;
 	struct tty_ldisc ldisc;
+	atomic_t ldisc_refs;		/* References to ldisc, see tty_io.c */
 	struct semaphore termios_sem;
 	struct termios *termios, *termios_locked;
 	char name[64];
@@ -309,6 +344,7 @@ struct tty_struct {
 #define TTY_CLOSING 		7	/* ->close() in progress */
 #define TTY_DONT_FLIP 		8	/* Defer buffer flip */
 #define TTY_LDISC 		9	/* Line discipline attached */
+#define TTY_FLUSHING 		10	/* flush_to_ldisc() is draining */
 #define TTY_HW_COOK_OUT 	14	/* Hardware can do output cooking */
 #define TTY_HW_COOK_IN 		15	/* Hardware can do input cooking */
 #define TTY_PTY_LOCK 		16	/* pty private */
@@ -351,6 +387,9 @@ extern int tty_hung_up_p(struct file * filp);
 extern void do_SAK(struct tty_struct *tty);
 extern void disassociate_ctty(int priv);
 extern void tty_flip_buffer_push(struct tty_struct *tty);
+extern int tty_insert_flip_string(struct tty_struct *tty, const unsigned char *chars, int count);
+extern int tty_insert_flip_flag(struct tty_struct *tty, unsigned char ch, char flag);
+extern int tty_buffer_request_room(struct tty_struct *tty, int size);
 extern int tty_get_baud_rate(struct tty_struct *tty);
 extern int tty_termios_baud_rate(struct termios *termios);
 
@@ -0,0 +1,34 @@
+/*
+ * vcs.h
+ *
+ * Userspace interface of /dev/vcs and /dev/vcsa beyond read and write.
+ */
+
+#ifndef _LINUX_VCS_H_
+#define _LINUX_VCS_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * VCS_GETDELTA: which rows changed since the caller last looked.
+ * Pass in the seq returned by the previous call (0 the first time);
+ * on return seq is the current delta sequence number and the bit of
+ * every row changed since the passed-in seq is set in rows. Rows may be
+ * reported changed spuriously, but a changed row is never missed: if
+ * one past the end of the bitmap changed, VCS_DELTA_ALL is set in flags
+ * and the caller should reread the whole screen.
+ */
+#define VCS_DELTA_ROWS	256
+
+#define VCS_DELTA_ALL	0x0001	/* Rows beyond the bitmap changed */
+
+struct vcs_delta {
+	__u32 seq;
+	__u32 flags;
+	__u8 rows[VCS_DELTA_ROWS / 8];	/* Bitmap, one bit per row, LSB first */
+};
+
+#define VCS_GETDELTA	_IOWR('V', 0x80, struct vcs_delta)
+
+#endif
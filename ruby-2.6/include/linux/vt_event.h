@@ -0,0 +1,36 @@
+/*
+ * vt_event.h
+ *
+ * Userspace interface of /dev/vtevent, which reports VT switches,
+ * blanking and resizes as they happen.
+ */
+
+#ifndef _LINUX_VT_EVENT_H_
+#define _LINUX_VT_EVENT_H_
+
+#include <linux/types.h>
+
+/*
+ * read() returns whole struct vt_event records, oldest first, and
+ * blocks unless the file is O_NONBLOCK; poll() reports POLLIN while
+ * any are queued. VC numbers count from 1 like /dev/ttyN. A reader
+ * that falls VT_EVENT_QUEUE records behind loses the oldest ones and
+ * gets VT_EVENT_OVERRUN set on the next record it reads.
+ */
+struct vt_event {
+	__u32 event;		/* VT_EVENT_* */
+	__u32 display;		/* Display (vt_num) it happened on */
+	__u32 oldvc;		/* VC switched away from, else as newvc */
+	__u32 newvc;		/* VC now in front / blanked / resized */
+	__u32 pad[4];
+};
+
+#define VT_EVENT_SWITCH		0x0001
+#define VT_EVENT_BLANK		0x0002
+#define VT_EVENT_UNBLANK	0x0004
+#define VT_EVENT_RESIZE		0x0008
+#define VT_EVENT_OVERRUN	0x8000
+
+#define VT_EVENT_QUEUE		64
+
+#endif
@@ -11,6 +11,9 @@
 #include <linux/vt.h>
 #include <linux/kbd_kern.h>
 #include <linux/device.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+#include <asm/semaphore.h>
 
 #define MIN_NR_CONSOLES 1	/* must be at least 1 */
 #define MAX_NR_CONSOLES 63	/* serial lines start at 64 */
@@ -57,6 +60,40 @@
 
 #define BUF_SIZE (CONFIG_BASE_SMALL ? 256 : PAGE_SIZE)
 
+/*
+ * Output counters, shown in /sys/class/vt/. Only bumped under the
+ * display's vt_sem, so plain longs will do.
+ */
+struct vc_stats {
+	unsigned long bytes;		/* Written to the tty */
+	unsigned long glyphs;		/* Characters stored in the screen */
+	unsigned long putcs;		/* con_putcs calls */
+	unsigned long putcs_cells;	/* Cells they drew */
+	unsigned long scroll_hw;	/* Scrolls done by con_scroll_region */
+	unsigned long scroll_soft;	/* Scrolls done by sliding vc_origin */
+	unsigned long scroll_copy;	/* Scrolls done by memmove */
+	unsigned long escapes;		/* ESC and CSI sequences started */
+};
+
+static inline void vc_stats_add(struct vc_stats *to, const struct vc_stats *from)
+{
+	to->bytes += from->bytes;
+	to->glyphs += from->glyphs;
+	to->putcs += from->putcs;
+	to->putcs_cells += from->putcs_cells;
+	to->scroll_hw += from->scroll_hw;
+	to->scroll_soft += from->scroll_soft;
+	to->scroll_copy += from->scroll_copy;
+	to->escapes += from->escapes;
+}
+
+/*
+ * The in-memory screen buffer holds this many screens worth of rows.
+ * Full screen scrolls then just slide vc_origin down the buffer and
+ * only fold the screen back to the start once it runs off the end.
+ */
+#define VC_SCREENBUF_PAGES 2
+
 extern int is_console_locked(void);
 extern unsigned char color_table[];
 extern int default_red[];
@@ -87,6 +124,16 @@ struct vc_data {
 	unsigned int vc_top, vc_bottom;	/* Scrolling region */
 	unsigned short *vc_screenbuf;	/* In-memory character/attribute buffer */
 	unsigned int vc_screenbuf_size;
+	unsigned int vc_screenbuf_alloc;/* Bytes allocated for vc_screenbuf */
+	struct list_head vc_hist;	/* Scrollback history, oldest first */
+	unsigned int vc_hist_lines;	/* Rows on vc_hist */
+	unsigned int vc_hist_view;	/* Rows scrolled back into vc_hist */
+	struct vcs_shadow *vc_shadow;	/* mmap() image of /dev/vcsa */
+	struct vcs_rows *vc_vcs_rows;	/* Per-row change tracking */
+	unsigned int vc_vcs_seq;	/* Bumped on every screen change */
+	unsigned int vc_delta_seq;	/* VCS_GETDELTA's, see vcs_rows_update() */
+	wait_queue_head_t vc_vcs_wait;	/* poll() on /dev/vcs */
+	struct vc_stats vc_stats;	/* Output counters */
 	unsigned char vc_attr;		/* Current attributes */
 	unsigned char vc_def_color;	/* Default colors */
 	unsigned char vc_color;		/* Foreground & background */
@@ -145,7 +192,8 @@ struct vc_data {
 	unsigned int vc_need_wrap:1;
 	unsigned int vc_can_do_color:1;
 	unsigned int vc_report_mouse:2;
-        unsigned int vc_kmalloced:1;
+	unsigned int vc_kmalloced:1;	/* vc_screenbuf came from kmalloc */
+	unsigned int vc_slab:1;		/* vc_data came from vc_cachep */
 	unsigned char vc_utf:1;		/* Unicode UTF-8 encoding */
 	unsigned char vc_utf_count;
 	int vc_utf_char;
@@ -231,6 +279,7 @@ struct vt_struct {
 	int off_interval;
 	int blank_state;
 	int blank_timer_expired;
+	int poke_blanked;		/* Input seen, vt_work should unblank */
 	struct timer_list timer;	/* Timer for VT blanking */
 	struct timer_list beep;	/* Timer for adjusting console beeping */
 	struct pm_dev *pm_con;		/* power management */
@@ -242,10 +291,20 @@ struct vt_struct {
          */
 	struct semaphore lock;		/* Lock for con_buf */
 	char con_buf[BUF_SIZE];
+	struct semaphore vt_sem;	/* Lock for this display, see below */
+	struct task_struct *vt_owner;	/* Holder of vt_sem */
+	unsigned long long vt_lock_since;	/* sched_clock() when taken */
+	unsigned long long vt_lock_ns;	/* Total time vt_sem was held */
+	unsigned long long vt_lock_max;	/* Longest single hold */
+	unsigned long vt_lock_count;	/* Times it was taken */
+	struct vc_stats vt_stats;	/* Counters of freed VCs */
 	const struct consw *vt_sw;	/* Display driver for VT */
 	struct vc_data *default_mode;	/* Default mode */
 	struct work_struct vt_work;	/* VT work queue */
+	struct workqueue_struct *vt_wq;	/* Runs vt_work, once keventd is up */
+	char vt_wq_name[16];
 	struct input_handle *keyboard;  /* Keyboard attached */
+	struct kbd_seat kbd;		/* Its state */
 	struct input_handle *beeper;	/* Bell noise support */
 	void *data_hook;		/* Hook for driver data */	
 	unsigned int first_vc;
@@ -262,6 +321,16 @@ struct vt_struct {
 extern struct list_head vt_list;
 extern struct vt_struct *admin_vt;
 
+/*
+ * Row lookup into the screen. The rows are contiguous from vc_origin,
+ * but vc_origin may slide inside vc_screenbuf, so never index the
+ * screen buffer directly.
+ */
+static inline unsigned short *vc_row(struct vc_data *vc, unsigned int y)
+{
+	return (unsigned short *) (vc->vc_origin + y * vc->vc_size_row);
+}
+
 #define	to_vt_struct(n) container_of(n, struct vt_struct, dev)
 
 /* universal VT emulation functions */
@@ -277,21 +346,53 @@ void terminal_emulation(struct tty_struct *tty, int c);
 /* Some debug stub to catch some of the obvious races in the VT code */
 #if 1
 #define WARN_CONSOLE_UNLOCKED() WARN_ON(!is_console_locked() && !oops_in_progress)
+#define WARN_VT_UNLOCKED(vt)	WARN_ON((vt)->vt_owner != current && !oops_in_progress)
 #else
 #define WARN_CONSOLE_UNLOCKED()
+#define WARN_VT_UNLOCKED(vt)
 #endif
 
+/*
+ * Locking. Each display has its own vt_sem, covering its VCs, their
+ * screens and its driver, so output on one display never waits for
+ * another. The console semaphore is the outer lock and is only for
+ * what spans displays: vt_list, allocating VCs, binding drivers, the
+ * selection, and holding more than one vt_sem at a time. Take it
+ * first, then the vt_sem of each display you touch.
+ */
+static inline void acquire_vt_sem(struct vt_struct *vt)
+{
+	down(&vt->vt_sem);
+	vt->vt_owner = current;
+	vt->vt_lock_since = sched_clock();
+}
+
+/* Like try_acquire_console_sem(): 0 on success */
+static inline int try_acquire_vt_sem(struct vt_struct *vt)
+{
+	if (down_trylock(&vt->vt_sem))
+		return -1;
+	vt->vt_owner = current;
+	vt->vt_lock_since = sched_clock();
+	return 0;
+}
+
+void release_vt_sem(struct vt_struct *vt);
+void schedule_vt_work(struct vt_struct *vt);
+
 const char *vt_map_display(struct vt_struct *vt, int init, int vc_count);
 void vt_map_input(struct vt_struct *vt);
 struct vc_data *find_vc(int currcons);
 struct vc_data *vc_allocate(unsigned int console);
 inline void set_console(struct vc_data *vc);
 int vc_resize(struct vc_data *vc, unsigned int lines, unsigned int cols);
+int vc_screen_need(struct vc_data *vc, unsigned int gfp_mask);
 int vc_disallocate(struct vc_data *vc);
 void reset_vc(struct vc_data *vc);
 void add_softcursor(struct vc_data *vc);
 void set_cursor(struct vc_data *vc);
 void hide_cursor(struct vc_data *vc);
+void history_unview(struct vc_data *vc);
 void gotoxy(struct vc_data *vc, int new_x, int new_y);
 inline void gotoxay(struct vc_data *vc, int new_x, int new_y);
 void reset_palette(struct vc_data *vc);
@@ -346,9 +447,40 @@ void con_protect_unimap(struct vc_data *vc, int rdonly);
 int con_copy_unimap(struct vc_data *dst, struct vc_data *src);
 
 /* vt_ioctl.c */
+void __init vt_waitactive_init(void);
+void vt_waitactive_wake(unsigned int num);
 void complete_change_console(struct vc_data *new_vc, struct vc_data *old_vc);
 void change_console(struct vc_data *new_vc, struct vc_data *old_vc);
 
+/* vc_screen.c */
+void __vcs_changed(struct vc_data *vc);
+void vcs_detach(struct vc_data *vc);
+
+static inline void vcs_changed(struct vc_data *vc)
+{
+	vc->vc_vcs_seq++;
+	if (vc->vc_shadow || waitqueue_active(&vc->vc_vcs_wait))
+		__vcs_changed(vc);
+}
+
+/* vt_history.c */
+#ifdef CONFIG_VT_HISTORY
+void vc_history_push(struct vc_data *vc, const u16 *p);
+unsigned int vc_history_read(struct vc_data *vc, unsigned int back,
+			     u16 *p, unsigned int nr);
+void vc_history_free(struct vc_data *vc);
+#else
+static inline void vc_history_push(struct vc_data *vc, const u16 *p) { }
+static inline unsigned int vc_history_read(struct vc_data *vc,
+		unsigned int back, u16 *p, unsigned int nr) { return 0; }
+static inline void vc_history_free(struct vc_data *vc) { }
+#endif
+
+/* vt_event.c */
+void vt_event_post(unsigned int event, struct vt_struct *vt,
+		   unsigned int oldvc, unsigned int newvc);
+int __init vt_event_init(void);
+
 /* vt_sysfs.c*/
 int __init vt_create_sysfs_dev_files (struct vt_struct *vt);
 void __init vt_sysfs_init(void);